@@ -0,0 +1,202 @@
+/*
+  ==============================================================================
+
+    MappedLoopBuffer.h
+    Created: 18 Oct 2026 10:12:31am
+    Author:  Solomon Moulang Lewis
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+
+#if JUCE_LINUX
+ #include <fcntl.h>
+ #include <unistd.h>
+#elif JUCE_MSVC
+ #include <intrin.h>
+#endif
+
+/**
+       @brief Disk backed loop memory for long loops.
+              The buffer is a memory mapped temporary file, so only the pages
+              around the read/write head need to be resident in RAM.
+              A background thread keeps touching the pages around the hot
+              regions published by the audio thread, so the audio thread
+              only ever touches pre-faulted pages.
+              The file is preallocated and lives in the user's app data folder,
+              not the temp folder, which is often RAM backed on Linux.
+*/
+class MappedLoopBuffer : private juce::Thread
+{
+public:
+    MappedLoopBuffer() : juce::Thread ("Loop Prefetch") {}
+    ~MappedLoopBuffer() override { Release(); }
+
+    /** Maps a zeroed buffer of num_samples samples and starts the prefetch thread.
+        prefetch_window is the number of samples kept resident either side of each
+        hot region. Returns false if the file couldn't be created or mapped.
+        Don't call from the audio thread.
+    */
+    bool Allocate (size_t num_samples, size_t bytes_per_sample, size_t prefetch_window)
+    {
+        Release();
+
+        const auto num_bytes = static_cast<juce::int64> (num_samples * bytes_per_sample);
+
+        const auto dir = juce::File::getSpecialLocation (juce::File::userApplicationDataDirectory)
+                             .getChildFile ("Time Warped Looper");
+
+        if (! dir.createDirectory())
+            return false;
+
+        file_ = std::make_unique<juce::TemporaryFile> (dir.getChildFile ("loop.loop"));
+
+        if (! Preallocate (file_->getFile(), num_bytes))
+        {
+            file_.reset();
+            return false;
+        }
+
+        map_ = std::make_unique<juce::MemoryMappedFile> (file_->getFile(),
+                                                         juce::MemoryMappedFile::readWrite);
+
+        if (map_->getData() == nullptr || map_->getSize() < static_cast<size_t> (num_bytes))
+        {
+            Release();
+            return false;
+        }
+
+        data_ = static_cast<char*> (map_->getData());
+        size_ = num_samples;
+        bytes_per_sample_ = bytes_per_sample;
+        window_ = juce::jmin (prefetch_window, num_samples / 2);
+
+        num_hot_.store (0);
+
+        startThread();
+
+        return true;
+    }
+
+    /** Stops prefetching, unmaps and deletes the backing file. */
+    void Release()
+    {
+        stopThread (1000);
+
+        data_ = nullptr;
+        size_ = 0;
+
+        map_.reset(); // unmap before the temporary file is deleted
+        file_.reset();
+    }
+
+    bool IsMapped() const { return data_ != nullptr; }
+    template <typename T>
+    T* GetData() const { return reinterpret_cast<T*> (data_); }
+    size_t GetSize() const { return size_; }
+
+    static constexpr size_t kMaxHotRegions = 16;
+
+    /** Publishes the centres of the regions of the buffer the looper is about
+        to touch, up to kMaxHotRegions of them.
+        Called once per block from the audio thread, atomics only.
+    */
+    void SetHotRegions (const size_t *centres, size_t num)
+    {
+        jassert (num <= kMaxHotRegions);
+        num = juce::jmin (num, kMaxHotRegions);
+
+        for (size_t i = 0; i < num; i++)
+            hot_[i].store (centres[i], std::memory_order_relaxed);
+
+        num_hot_.store (num, std::memory_order_relaxed);
+    }
+
+private:
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            // a head can move in either direction and jumps to either end
+            // of its segment when it wraps, so the looper publishes all three
+            const size_t num = num_hot_.load (std::memory_order_relaxed);
+            for (size_t i = 0; i < num; i++)
+                TouchAround (hot_[i].load (std::memory_order_relaxed));
+
+            wait (5);
+        }
+    }
+
+    void TouchAround (size_t centre)
+    {
+        const size_t start = (centre + size_ - window_) % size_;
+
+        // a read fault only maps a page of a shared file read only, write to
+        // one byte per page so recording into it doesn't fault again
+        const size_t samples_per_page = kPageSize / bytes_per_sample_;
+
+        for (size_t i = 0; i < 2 * window_; i += samples_per_page)
+        {
+            WriteTouch (data_ + ((start + i) % size_) * bytes_per_sample_);
+        }
+    }
+
+    // adds 0 to the byte atomically, a write as far as the MMU is concerned
+    // that can't lose a sample the audio thread writes at the same time
+    static void WriteTouch (char *p)
+    {
+       #if JUCE_MSVC
+        _InterlockedExchangeAdd8 (p, 0);
+       #else
+        __atomic_fetch_add (p, 0, __ATOMIC_RELAXED);
+       #endif
+    }
+
+    // gives the file all its disk blocks up front, a sparse file would have
+    // the first write to each page allocate them on the audio thread
+    static bool Preallocate (const juce::File& file, juce::int64 num_bytes)
+    {
+       #if JUCE_LINUX
+        const int fd = ::open (file.getFullPathName().toRawUTF8(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            return false;
+
+        const bool ok = posix_fallocate (fd, 0, static_cast<off_t> (num_bytes)) == 0;
+        ::close (fd);
+        return ok;
+       #else
+        juce::FileOutputStream out (file);
+        if (out.failedToOpen())
+            return false;
+
+        const juce::HeapBlock<char> zeros (kPageSize * 16, true);
+        for (juce::int64 written = 0; written < num_bytes;)
+        {
+            const auto n = juce::jmin (static_cast<juce::int64> (kPageSize * 16), num_bytes - written);
+            if (! out.write (zeros, static_cast<size_t> (n)))
+                return false;
+            written += n;
+        }
+        return true;
+       #endif
+    }
+
+    static constexpr size_t kPageSize = 4096;
+
+    std::unique_ptr<juce::TemporaryFile> file_;
+    std::unique_ptr<juce::MemoryMappedFile> map_;
+
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t bytes_per_sample_ = sizeof (float);
+    size_t window_ = 0;
+
+    std::atomic<size_t> hot_[kMaxHotRegions] {};
+    std::atomic<size_t> num_hot_ {0};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MappedLoopBuffer)
+};
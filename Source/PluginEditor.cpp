@@ -11,11 +11,16 @@
 
 //==============================================================================
 Looper_testAudioProcessorEditor::Looper_testAudioProcessorEditor (Looper_testAudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
+    : AudioProcessorEditor (&p), audioProcessor (p),
+      waveform_ ([&p] { return p.getOverview(); }),
+      params_ (p)
 {
+    addAndMakeVisible (waveform_);
+    addAndMakeVisible (params_);
+    
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    setSize (juce::jmax (600, params_.getWidth()), kWaveformHeight + params_.getHeight());
 }
 
 Looper_testAudioProcessorEditor::~Looper_testAudioProcessorEditor()
@@ -27,14 +32,11 @@ void Looper_testAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-
-    g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
 }
 
 void Looper_testAudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    auto bounds = getLocalBounds();
+    waveform_.setBounds (bounds.removeFromTop (kWaveformHeight));
+    params_.setBounds (bounds);
 }
@@ -10,6 +10,7 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "WaveformView.h"
 
 //==============================================================================
 /**
@@ -25,9 +26,14 @@ public:
     void resized() override;
 
 private:
+    static constexpr int kWaveformHeight = 160;
+    
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     Looper_testAudioProcessor& audioProcessor;
+    
+    WaveformView waveform_;
+    juce::GenericAudioProcessorEditor params_;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Looper_testAudioProcessorEditor)
 };
@@ -9,6 +9,7 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 #include "ParamHelpers.h"
+#include "rt_check.h"
 
 //==============================================================================
 Looper_testAudioProcessor::Looper_testAudioProcessor()
@@ -17,16 +18,40 @@ Looper_testAudioProcessor::Looper_testAudioProcessor()
                      #if ! JucePlugin_IsMidiEffect
                       #if ! JucePlugin_IsSynth
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                       .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
                        )
 #endif
 {
+    RtCheck::Install();
+    
+    // the pattern is read every block, skip the parameter lookup by name
+    for (size_t i = 0; i < StepSequencer::kMaxSteps; i++)
+    {
+        const juce::String step = "step-" + juce::String (i + 1);
+        step_seg_params_[i] = apvts.getRawParameterValue (step + "-seg");
+        step_manip_params_[i] = apvts.getRawParameterValue (step + "-manip");
+    }
+    
+    for (size_t h = 1; h < Looper::kMaxHeads; h++)
+    {
+        const juce::String head = "head-" + juce::String (h + 1);
+        auto& p = head_params_[h - 1];
+        p.gain = apvts.getRawParameterValue (head + "-gain");
+        p.division = apvts.getRawParameterValue (head + "-division");
+        p.seg_sel = apvts.getRawParameterValue (head + "-seg-sel");
+        p.time_manip = apvts.getRawParameterValue (head + "-time-manip");
+    }
 }
 
 Looper_testAudioProcessor::~Looper_testAudioProcessor()
 {
+    if (pool_headroom_ > 0)
+        LoopPagePool::Instance().RemoveClient (pool_headroom_);
+    
+    LoopSyncBus::Instance().ReleaseMaster (this);
 }
 
 //==============================================================================
@@ -94,16 +119,76 @@ void Looper_testAudioProcessor::changeProgramName (int index, const juce::String
 //==============================================================================
 void Looper_testAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    loop_buf_.resize (sampleRate * 8, 0.f);
+    // long-loop mode swaps the 8 second in-memory buffer for a memory mapped file,
+    // both settings are picked up here so they take effect on the next prepareToPlay
+    const bool long_loop = apvts.getRawParameterValue ("long-loop")->load();
+    const bool half = apvts.getRawParameterValue ("storage")->load() > 0.5f;
+    const size_t bytes_per_sample = half ? sizeof (uint16_t) : sizeof (float);
     
-    looper_.Init (loop_buf_.data(), loop_buf_.size());
     looper_.state_ = Looper::LISTENING;
+    sidechain_env_.Init (static_cast<float> (sampleRate));
+    
+    seam_finder_.Start();
+    bouncer_.Stop(); // sized for the old buffer
+    
+    auto& pool = LoopPagePool::Instance();
+    
+    if (pool_headroom_ > 0)
+    {
+        pool.RemoveClient (pool_headroom_);
+        pool_headroom_ = 0;
+    }
+    
+    if (long_loop)
+    {
+        const auto mins = apvts.getRawParameterValue ("loop-mins")->load();
+        const auto size = static_cast<size_t> (sampleRate * 60.0 * mins);
+        
+        if (mapped_buf_.Allocate (size, bytes_per_sample, static_cast<size_t> (sampleRate * 2.0)))
+        {
+            // the mapped file starts zeroed, don't fault it all in by clearing it
+            if (half)
+                looper_.Init (mapped_buf_.GetData<uint16_t>(), mapped_buf_.GetSize(), false);
+            else
+                looper_.Init (mapped_buf_.GetData<float>(), mapped_buf_.GetSize(), false);
+            resetOverview (mapped_buf_.GetSize());
+            looper_.SetBouncer (nullptr); // bounces render into pool pages
+            return;
+        }
+    }
+    
+    mapped_buf_.Release();
+    
+    // in-memory loops take pages from the pool shared by every instance, only as
+    // recording reaches them, keep 2 seconds of pages free for this instance
+    // so the audio thread never has to wait on the pool growing
+    const auto size = static_cast<size_t> (sampleRate * 8);
+    const auto headroom_bytes = sampleRate * 2.0 * bytes_per_sample;
+    pool_headroom_ = static_cast<size_t> (std::ceil (headroom_bytes / LoopPagePool::kPageBytes));
+    pool.AddClient (pool_headroom_);
+    
+    const auto format = half ? LoopStorage::FLOAT16 : LoopStorage::FLOAT32;
+    looper_.Init (pool, format, size);
+    resetOverview (size);
+    
+    bouncer_.Start (pool, format, size);
+    looper_.SetBouncer (&bouncer_);
+}
+
+void Looper_testAudioProcessor::resetOverview (size_t size)
+{
+    // the editor may still be drawing the old overview, it goes when the editor lets go of it
+    auto overview = std::make_shared<LoopOverview> (size);
+    looper_.SetOverview (overview.get());
+    std::atomic_store (&overview_, overview);
 }
 
 void Looper_testAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    seam_finder_.Stop();
+    bouncer_.Stop();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -125,6 +210,16 @@ bool Looper_testAudioProcessor::isBusesLayoutSupported (const BusesLayout& layou
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
         return false;
+    
+    // the sidechain only feeds the envelope, any of its channels will do
+    if (layouts.inputBuses.size() > 1)
+    {
+        const auto sidechain = layouts.getChannelSet (true, 1);
+        if (! sidechain.isDisabled()
+         && sidechain != juce::AudioChannelSet::mono()
+         && sidechain != juce::AudioChannelSet::stereo())
+            return false;
+    }
    #endif
 
     return true;
@@ -146,30 +241,373 @@ void Looper_testAudioProcessor::updateParams()
 
 void Looper_testAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    // nothing in here may allocate, lock or print, see rt_check.h
+    RtCheck::Scope rt_scope;
+    
     bool current_toggle_state = apvts.getRawParameterValue("trig")->load();
     
     if (current_toggle_state != previous_toggle_state_)
     {
-        looper_.UpdatePlaybackState();
+        pending_trig_ = true;
     }
     
     previous_toggle_state_ = current_toggle_state;
     
-    looper_.SetSegmentDivisions ( apvts.getRawParameterValue( "division")   ->load());
-    looper_.SetSelectedSegment  ( apvts.getRawParameterValue( "seg-sel")    ->load());
-    looper_.SetTimeManipulation ( apvts.getRawParameterValue( "time-manip") ->load());
+    // undo, redo and bounce are toggles like trig, any change counts
+    const bool undo_state = apvts.getRawParameterValue ("undo")->load();
+    const bool redo_state = apvts.getRawParameterValue ("redo")->load();
+    const bool bounce_state = apvts.getRawParameterValue ("bounce")->load();
+    
+    if (undo_state != previous_undo_state_)
+        pending_undo_ = true;
+    if (redo_state != previous_redo_state_)
+        pending_redo_ = true;
+    if (bounce_state != previous_bounce_state_)
+        pending_bounce_ = true;
+    
+    previous_undo_state_ = undo_state;
+    previous_redo_state_ = redo_state;
+    previous_bounce_state_ = bounce_state;
+    
+    const float time_manip = apvts.getRawParameterValue ("time-manip")->load();
+    const bool seq_on = apvts.getRawParameterValue ("seq")->load();
+    const bool seamless = apvts.getRawParameterValue ("seamless")->load();
+    
+    looper_.SetSeamFinder (seamless ? &seam_finder_ : nullptr);
+    looper_.SetAntiAlias (apvts.getRawParameterValue ("anti-alias")->load());
+    
+    // grain size in ms and density in grains per second, pitch in semitones
+    const double sample_rate = getSampleRate();
+    looper_.SetGranular (apvts.getRawParameterValue ("grains")->load());
+    looper_.SetGrains (apvts.getRawParameterValue ("grain-pos")->load(),
+                       static_cast<size_t> (apvts.getRawParameterValue ("grain-size")->load() * 0.001 * sample_rate),
+                       std::exp2 (apvts.getRawParameterValue ("grain-pitch")->load() / 12.f),
+                       static_cast<float> (sample_rate / apvts.getRawParameterValue ("grain-density")->load()));
     
-    for (int s = 0; s < buffer.getNumSamples(); s++)
+    const auto grid = static_cast<TempoSync::Grid> (apvts.getRawParameterValue ("quantize")->load());
+    sync_.Update (getPlayHead(), getSampleRate(), grid);
+    
+    // synced changes land on the grid line's exact sample, not the next zero crossing
+    const bool zero_cross = apvts.getRawParameterValue ("zero-cross")->load();
+    looper_.SetZeroCrossingTransitions (zero_cross && ! sync_.IsActive());
+    
+    const auto num_samples = buffer.getNumSamples();
+    auto* samples = buffer.getWritePointer (0);
+    
+    const auto sidechain = getBusCount (true) > 1 ? getBusBuffer (buffer, true, 1)
+                                                   : juce::AudioBuffer<float>();
+    const bool modulating = sidechain.getNumChannels() > 0
+                         && (apvts.getRawParameterValue ("sc-seg")->load() != 0.f
+                          || apvts.getRawParameterValue ("sc-speed")->load() != 0.f);
+    sidechain_env_.SetTimes (apvts.getRawParameterValue ("sc-attack")->load(),
+                             apvts.getRawParameterValue ("sc-release")->load());
+    mod_start_ = mod_end_ = 0;
+    
+    // state changes and segment switches wait for the next grid line when synced,
+    // the block is split there so they land on the exact sample
+    const int split = sync_.IsActive() ? sync_.SamplesToNextGridLine() : 0;
+    bool grid_line_due = split < num_samples;
+    
+    updateLoopSync (num_samples);
+    updateSequencer();
+    looper_.SetSegmentDivisions (division_hold_.Get (division_));
+    
+    for (size_t h = 1; h < Looper::kMaxHeads; h++)
+        looper_.SetHeadGain (head_params_[h - 1].gain->load(), h);
+    
+    // mono looper, processed in place on the left channel then copied to the right.
+    // the block is also split wherever a sequencer step starts
+    int pos = 0;
+    bool silent = true;
+    while (pos < num_samples)
     {
-        auto in_s = buffer.getSample (0, s);
+        if (grid_line_due && pos == split)
+        {
+            applyGridLine();
+            grid_line_due = false;
+        }
+        
+        const bool sequencing = seq_on && looper_.state_ == Looper::PLAYING;
+        
+        // the pattern starts over with playback, or wherever it's switched on
+        if (sequencing && ! sequencing_)
+        {
+            sequencer_.SetLoopLength (looper_.GetRecordingLength());
+            sequencer_.Compile();
+            sequencer_.Reset();
+        }
+        sequencing_ = sequencing;
+        
+        int end = grid_line_due ? split : num_samples;
         
-        auto out_s = looper_.Process (in_s);
+        if (sequencing)
+        {
+            while (sequencer_.PopStep())
+                applyStep (sequencer_.CurrentStep());
+            
+            end = pos + static_cast<int> (juce::jmin (sequencer_.SamplesToNextStep(),
+                                                      static_cast<size_t> (end - pos)));
+        }
+        else if (modulating)
+        {
+            end = applyModulation (sidechain, pos, end,
+                                   seg_sel_hold_.Get (seg_sel_),
+                                   time_manip_hold_.Get (time_manip));
+        }
+        else
+        {
+            looper_.SetTimeManipulation (time_manip_hold_.Get (time_manip));
+            looper_.SetSelectedSegment (seg_sel_hold_.Get (seg_sel_));
+        }
         
-        buffer.setSample (0, s, out_s); // l
-        buffer.setSample (1, s, out_s); // r
+        looper_.ProcessBlock (samples + pos, samples + pos, static_cast<size_t> (end - pos));
+        silent = silent && looper_.OutputWasSilent();
+        
+        // a bounce was swapped in during that block
+        if (looper_.GetBounceCount() != bounce_count_)
+        {
+            bounce_count_ = looper_.GetBounceCount();
+            division_hold_.Hold (division_);
+            seg_sel_hold_.Hold (seg_sel_);
+            time_manip_hold_.Hold (time_manip);
+        }
+        
+        if (sequencing)
+            sequencer_.Advance (static_cast<size_t> (end - pos));
+        
+        pos = end;
+    }
+    
+    // the looper only played silent parts of the loop, clearing marks the
+    // buffer as silent for anything after the plugin that checks
+    if (silent)
+        buffer.clear();
+    else if (getMainBusNumOutputChannels() > 1)
+        buffer.copyFrom (1, 0, buffer, 0, 0, num_samples);
+    
+    if (mapped_buf_.IsMapped())
+    {
+        static_assert (Looper::kMaxHotSpots <= MappedLoopBuffer::kMaxHotRegions, "prefetcher can't keep every head resident");
+        
+        size_t hot[Looper::kMaxHotSpots];
+        mapped_buf_.SetHotRegions (hot, looper_.GetHotSpots (hot));
+    }
+}
+
+void Looper_testAudioProcessor::applyGridLine()
+{
+    if (pending_trig_)
+    {
+        // a follower's recording is cut to its share of the master loop
+        if (sync_length_ > 0 && looper_.state_ == Looper::RECORDING)
+        {
+            looper_.SetRecordingLength (sync_length_);
+        }
+        // a synced recording stops on a grid line, trim it to a whole number
+        // of grid divisions so it keeps in time with the host
+        else if (sync_.IsActive() && looper_.state_ == Looper::RECORDING)
+        {
+            const double grid_len = sync_.SamplesPerGridLine();
+            const double recorded = static_cast<double> (looper_.GetRecordingLength()) / Looper::kOne;
+            const double lines = juce::jmax (1.0, std::round (recorded / grid_len));
+            
+            looper_.SetRecordingLength (static_cast<Looper::Phase> (lines * grid_len * Looper::kOne));
+        }
+        
+        looper_.UpdatePlaybackState();
+        pending_trig_ = false;
+    }
+    
+    if (pending_undo_ || pending_redo_)
+    {
+        // the loop from before a bounce wants the params as they are
+        division_hold_ = {};
+        seg_sel_hold_ = {};
+        time_manip_hold_ = {};
+    }
+    
+    if (pending_undo_)
+    {
+        looper_.Undo();
+        pending_undo_ = false;
+    }
+    
+    if (pending_redo_)
+    {
+        looper_.Redo();
+        pending_redo_ = false;
+    }
+    
+    if (pending_bounce_)
+    {
+        looper_.Bounce();
+        pending_bounce_ = false;
+    }
+    
+    division_ = apvts.getRawParameterValue ("division")->load();
+    seg_sel_ = apvts.getRawParameterValue ("seg-sel")->load();
+    const bool slices = apvts.getRawParameterValue ("slices")->load();
+    
+    looper_.SetSegmentDivisions (division_hold_.Get (division_));
+    looper_.SetSliceMode (slices);
+    
+    for (size_t h = 1; h < Looper::kMaxHeads; h++)
+    {
+        const auto& p = head_params_[h - 1];
+        looper_.SetSegmentDivisions (p.division->load(), h);
+        looper_.SetSliceMode (slices, h);
+        looper_.SetSelectedSegment (p.seg_sel->load(), h);
+        looper_.SetTimeManipulation (p.time_manip->load(), h);
     }
 }
 
+int Looper_testAudioProcessor::applyModulation (const juce::AudioBuffer<float>& sidechain, int pos, int end,
+                                                float seg_sel, float time_manip)
+{
+    // the envelope is worked out a chunk at a time as the block reaches it,
+    // every split lands inside the chunk so the follower never runs twice
+    if (pos >= mod_end_)
+    {
+        mod_start_ = pos;
+        mod_end_ = juce::jmin (pos + kModChunk, sidechain.getNumSamples());
+        sidechain_env_.Process (sidechain.getArrayOfReadPointers(),
+                                static_cast<size_t> (sidechain.getNumChannels()),
+                                static_cast<size_t> (mod_start_),
+                                mod_env_,
+                                static_cast<size_t> (mod_end_ - mod_start_));
+    }
+    
+    const float seg_depth = apvts.getRawParameterValue ("sc-seg")->load();
+    const float speed_depth = apvts.getRawParameterValue ("sc-speed")->load();
+    const int num_segments = static_cast<int> (looper_.GetNumSegments());
+    
+    // a segment and a time manipulation for each sample, picked the same way
+    // the looper picks them from the params, without branching
+    auto step_of = [&] (int i)
+    {
+        const float env = mod_env_[i - mod_start_];
+        const float seg = seg_sel + env * seg_depth;
+        const float manip = time_manip + env * speed_depth;
+        
+        const int segment = juce::jlimit (0, num_segments - 1, static_cast<int> (seg * num_segments));
+        const int manipulation = (manip > 0.25f) + (manip > 0.5f) + (manip > 0.75f);
+        return segment * 4 + manipulation;
+    };
+    
+    end = juce::jmin (end, mod_end_);
+    
+    const int step = step_of (pos);
+    int next = pos + 1;
+    while (next < end && step_of (next) == step)
+        next++;
+    
+    looper_.SetSelectedSegmentIndex (step / 4);
+    looper_.SetTimeManipulation (static_cast<Looper::TimeManipulation> (step % 4));
+    return next;
+}
+
+void Looper_testAudioProcessor::updateSequencer()
+{
+    sequencer_.SetNumSteps (static_cast<size_t> (apvts.getRawParameterValue ("seq-steps")->load()));
+    
+    for (size_t i = 0; i < StepSequencer::kMaxSteps; i++)
+    {
+        sequencer_.SetStep (i,
+                            static_cast<int> (step_seg_params_[i]->load()),
+                            static_cast<Looper::TimeManipulation> (step_manip_params_[i]->load()));
+    }
+    
+    // only recompiles if something changed
+    if (looper_.state_ == Looper::PLAYING)
+        sequencer_.SetLoopLength (looper_.GetRecordingLength());
+    sequencer_.Compile();
+}
+
+void Looper_testAudioProcessor::updateLoopSync (int num_samples)
+{
+    static constexpr int kRatioNum[] = {1, 1, 1, 1, 2, 4, 8};
+    static constexpr int kRatioDen[] = {8, 4, 2, 1, 1, 1, 1};
+    static constexpr int kSettleBlocks = 4;
+    static constexpr Looper::Phase kLockTolerance = Looper::kOne / 4;
+    
+    auto& bus = LoopSyncBus::Instance();
+    const auto role = static_cast<SyncRole> (apvts.getRawParameterValue ("sync-role")->load());
+    const auto ratio = static_cast<int> (apvts.getRawParameterValue ("sync-ratio")->load());
+    const auto now = LoopSyncBus::NowNs();
+    
+    sync_length_ = 0;
+    
+    if (role != SYNC_MASTER)
+        bus.ReleaseMaster (this);
+    
+    if (role == SYNC_MASTER)
+    {
+        if (! bus.ClaimMaster (this))
+            return;
+        
+        LoopSyncBus::State s;
+        s.length = looper_.state_ == Looper::PLAYING ? looper_.GetRecordingLength() : 0;
+        s.clock = looper_.GetLoopClock();
+        s.cycles = looper_.GetLoopCycles();
+        s.block = static_cast<size_t> (num_samples);
+        s.time_ns = now;
+        bus.Publish (s);
+        return;
+    }
+    
+    LoopSyncBus::State s;
+    if (role != SYNC_FOLLOWER || ! bus.Read (s))
+        return;
+    
+    // integer multiples and divisions of the master loop, a division drops
+    // the remainder so the follower creeps a few 2^-32 of a sample per cycle
+    const auto num = kRatioNum[ratio];
+    const auto den = kRatioDen[ratio];
+    sync_length_ = s.length * num / den;
+    
+    if (looper_.state_ != Looper::PLAYING || looper_.GetRecordingLength() != sync_length_)
+    {
+        sync_mismatch_blocks_ = 0;
+        return;
+    }
+    
+    // the master published within the last half block, it's already been
+    // processed this time round, otherwise it's still a block behind
+    Looper::Phase clock = s.clock;
+    int64_t cycles = s.cycles;
+    const double block_ns = 1.0e9 * num_samples / getSampleRate();
+    if (static_cast<double> (now - s.time_ns) > 0.5 * block_ns)
+    {
+        clock += Looper::ToPhase (s.block);
+        cycles += clock / s.length;
+        clock %= s.length;
+    }
+    
+    const Looper::Phase target = num > 1 ? (cycles % num) * s.length + clock
+                                         : clock % sync_length_;
+    
+    // only pull the loop round once it's been out by more than the lock
+    // tolerance for a few blocks running, so a block the ordering was
+    // misread for doesn't make it jump
+    Looper::Phase error = std::abs (target - looper_.GetLoopClock());
+    error = std::min (error, sync_length_ - error);
+    if (error <= kLockTolerance)
+    {
+        sync_mismatch_blocks_ = 0;
+    }
+    else if (++sync_mismatch_blocks_ >= kSettleBlocks)
+    {
+        looper_.SetLoopClock (target);
+        sync_mismatch_blocks_ = 0;
+    }
+}
+
+void Looper_testAudioProcessor::applyStep (const StepSequencer::Step& step)
+{
+    looper_.SetSelectedSegmentIndex (step.segment);
+    looper_.SetTimeManipulation (step.time_manip);
+}
+
 //==============================================================================
 bool Looper_testAudioProcessor::hasEditor() const
 {
@@ -178,8 +616,7 @@ bool Looper_testAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* Looper_testAudioProcessor::createEditor()
 {
-//    return new Looper_testAudioProcessorEditor (*this);
-    return new juce::GenericAudioProcessorEditor (*this);
+    return new Looper_testAudioProcessorEditor (*this);
 }
 
 //==============================================================================
@@ -204,6 +641,15 @@ juce::AudioProcessorValueTreeState::ParameterLayout Looper_testAudioProcessor::c
     
     layout.add (ap_bool (id ("trig"),
                          false));
+    
+    layout.add (ap_bool (id ("undo"),
+                         false));
+    
+    layout.add (ap_bool (id ("redo"),
+                         false));
+    
+    layout.add (ap_bool (id ("bounce"),
+                         false));
 
     layout.add (ap_float (id ("division"),
                           {0.f, 1.f, 0.00001f, 1.f},
@@ -217,6 +663,120 @@ juce::AudioProcessorValueTreeState::ParameterLayout Looper_testAudioProcessor::c
                           {0.f, 1.f, 0.00001f, 1.f},
                           0));
     
+    layout.add (ap_bool (id ("long-loop"),
+                         false));
+    
+    layout.add (ap_int (id ("loop-mins"),
+                        1, 60,
+                        2));
+    
+    layout.add (ap_choice (id ("storage"),
+                           {"float", "half"},
+                           0));
+    
+    layout.add (ap_choice (id ("quantize"),
+                           {"off", "beat", "bar"},
+                           0));
+    
+    layout.add (ap_bool (id ("slices"),
+                         false));
+    
+    layout.add (ap_bool (id ("seamless"),
+                         false));
+    
+    layout.add (ap_bool (id ("anti-alias"),
+                         true));
+    
+    layout.add (ap_bool (id ("zero-cross"),
+                         true));
+    
+    layout.add (ap_choice (id ("sync-role"),
+                           {"off", "master", "follower"},
+                           0));
+    
+    layout.add (ap_choice (id ("sync-ratio"),
+                           {"1/8", "1/4", "1/2", "1", "2", "4", "8"},
+                           3));
+    
+    layout.add (ap_bool (id ("grains"),
+                         false));
+    
+    layout.add (ap_float (id ("grain-pos"),
+                          {0.f, 1.f, 0.00001f, 1.f},
+                          0));
+    
+    layout.add (ap_float (id ("grain-size"),
+                          {10.f, 500.f, 0.1f, 0.5f},
+                          80.f));
+    
+    layout.add (ap_float (id ("grain-pitch"),
+                          {-12.f, 12.f, 0.01f, 1.f},
+                          0));
+    
+    layout.add (ap_float (id ("grain-density"),
+                          {1.f, 2000.f, 0.1f, 0.3f},
+                          100.f));
+    
+    // sidechain envelope onto seg-sel and time-manip, attack and release in ms
+    layout.add (ap_float (id ("sc-seg"),
+                          {-1.f, 1.f, 0.001f, 1.f},
+                          0.f));
+    
+    layout.add (ap_float (id ("sc-speed"),
+                          {-1.f, 1.f, 0.001f, 1.f},
+                          0.f));
+    
+    layout.add (ap_float (id ("sc-attack"),
+                          {0.1f, 100.f, 0.1f, 0.4f},
+                          1.f));
+    
+    layout.add (ap_float (id ("sc-release"),
+                          {1.f, 1000.f, 1.f, 0.4f},
+                          80.f));
+    
+    layout.add (ap_bool (id ("seq"),
+                         false));
+    
+    layout.add (ap_int (id ("seq-steps"),
+                        1, static_cast<int> (StepSequencer::kMaxSteps),
+                        4));
+    
+    // each step defaults to its own segment, playing forwards
+    for (int i = 0; i < static_cast<int> (StepSequencer::kMaxSteps); i++)
+    {
+        const juce::String step = "step-" + juce::String (i + 1);
+        
+        layout.add (ap_int (id (step + "-seg"),
+                            0, 127,
+                            i));
+        
+        layout.add (ap_choice (id (step + "-manip"),
+                               {"normal", "reverse", "half", "double"},
+                               0));
+    }
+    
+    // extra read heads, silent until their gain is raised
+    for (int h = 2; h <= static_cast<int> (Looper::kMaxHeads); h++)
+    {
+        const juce::String head = "head-" + juce::String (h);
+        
+        layout.add (ap_float (id (head + "-gain"),
+                              {0.f, 1.f, 0.00001f, 1.f},
+                              0));
+        
+        layout.add (ap_float (id (head + "-division"),
+                              {0.f, 1.f, 0.00001f, 1.f},
+                              0));
+        
+        layout.add (ap_float (id (head + "-seg-sel"),
+                              {0.f, 1.f, 0.00001f, 1.f},
+                              0));
+        
+        layout.add (ap_float (id (head + "-time-manip"),
+                              {0.f, 1.f, 0.00001f, 1.f},
+                              0));
+    }
+    
     
     
     return layout;
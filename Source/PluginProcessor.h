@@ -11,6 +11,11 @@
 #include <JuceHeader.h>
 #include "looper.h"
 #include "dsp.h"
+#include "MappedLoopBuffer.h"
+#include "TempoSync.h"
+#include "step_sequencer.h"
+#include "loop_sync_bus.h"
+#include "envelope_follower.h"
 
 //==============================================================================
 /**
@@ -62,13 +67,61 @@ public:
         TRIG,
         DIVISION,
         SEG_SEL,
-        TIME_MANIP
+        TIME_MANIP,
+        LONG_LOOP,
+        LOOP_MINS,
+        STORAGE,
+        QUANTIZE,
+        SEQ,
+        SEQ_STEPS,
+        SLICES,
+        SEAMLESS,
+        ANTI_ALIAS,
+        UNDO,
+        REDO,
+        GRAINS,
+        GRAIN_POS,
+        GRAIN_SIZE,
+        GRAIN_PITCH,
+        GRAIN_DENSITY,
+        ZERO_CROSS,
+        SYNC_ROLE,
+        SYNC_RATIO,
+        BOUNCE,
+        SC_SEG,
+        SC_SPEED,
+        SC_ATTACK,
+        SC_RELEASE
     };
     std::map<Names, juce::String> param_names_ {
         {TRIG, "trig"},
         {DIVISION, "division"},
         {SEG_SEL, "seg-sel"},
-        {TIME_MANIP, "time-manip"}
+        {TIME_MANIP, "time-manip"},
+        {LONG_LOOP, "long-loop"},
+        {LOOP_MINS, "loop-mins"},
+        {STORAGE, "storage"},
+        {QUANTIZE, "quantize"},
+        {SEQ, "seq"},
+        {SEQ_STEPS, "seq-steps"},
+        {SLICES, "slices"},
+        {SEAMLESS, "seamless"},
+        {ANTI_ALIAS, "anti-alias"},
+        {UNDO, "undo"},
+        {REDO, "redo"},
+        {GRAINS, "grains"},
+        {GRAIN_POS, "grain-pos"},
+        {GRAIN_SIZE, "grain-size"},
+        {GRAIN_PITCH, "grain-pitch"},
+        {GRAIN_DENSITY, "grain-density"},
+        {ZERO_CROSS, "zero-cross"},
+        {SYNC_ROLE, "sync-role"},
+        {SYNC_RATIO, "sync-ratio"},
+        {BOUNCE, "bounce"},
+        {SC_SEG, "sc-seg"},
+        {SC_SPEED, "sc-speed"},
+        {SC_ATTACK, "sc-attack"},
+        {SC_RELEASE, "sc-release"}
     };
     struct {
         bool trig_;
@@ -80,9 +133,90 @@ public:
     
     bool loop_toggle_ = false;
     bool previous_toggle_state_ = false;
+    bool previous_undo_state_ = false;
+    bool previous_redo_state_ = false;
+    bool previous_bounce_state_ = false;
+    
+    // trig, division and seg-sel changes wait here for the next grid line when synced
+    TempoSync sync_;
+    bool pending_trig_ = false;
+    bool pending_undo_ = false;
+    bool pending_redo_ = false;
+    bool pending_bounce_ = false;
+    float division_ = 0.f;
+    float seg_sel_ = 0.f;
+    void applyGridLine();
+    
+    // a bounce puts the warp in the loop, division, seg-sel and time-manip are
+    // then held at their defaults until they're moved, so it isn't applied twice
+    struct ParamHold {
+        bool active = false;
+        float value = 0.f;
+        
+        void Hold (float v) { active = true; value = v; }
+        float Get (float v)
+        {
+            if (active && v != value)
+                active = false;
+            return active ? 0.f : v;
+        }
+    };
+    ParamHold division_hold_, seg_sel_hold_, time_manip_hold_;
+    uint32_t bounce_count_ = 0;
+    
+    // segment/time-manip pattern, overrides seg-sel and time-manip while playing
+    StepSequencer sequencer_;
+    bool sequencing_ = false;
+    std::atomic<float>* step_seg_params_[StepSequencer::kMaxSteps] {};
+    std::atomic<float>* step_manip_params_[StepSequencer::kMaxSteps] {};
+    void updateSequencer();
+    void applyStep (const StepSequencer::Step& step);
+    
+    // loop length and phase shared with the other instances, see LoopSyncBus
+    enum SyncRole {
+        SYNC_OFF,
+        SYNC_MASTER,
+        SYNC_FOLLOWER
+    };
+    Looper::Phase sync_length_ = 0; // a follower's loop length, 0 when there's no master
+    int sync_mismatch_blocks_ = 0;
+    void updateLoopSync (int num_samples);
+    
+    // the sidechain's envelope added to seg-sel and time-manip at audio rate,
+    // the block is split on the sample it moves the main head to another
+    // segment or time manipulation
+    static constexpr int kModChunk = 64;
+    EnvelopeFollower sidechain_env_;
+    float mod_env_[kModChunk] {};
+    int mod_start_ = 0; // the samples of the block mod_env_ holds
+    int mod_end_ = 0;
+    int applyModulation (const juce::AudioBuffer<float>& sidechain, int pos, int end,
+                         float seg_sel, float time_manip);
+    
+    // extra read heads over the same loop, head 0 is driven by the params above
+    struct HeadParams {
+        std::atomic<float>* gain = nullptr;
+        std::atomic<float>* division = nullptr;
+        std::atomic<float>* seg_sel = nullptr;
+        std::atomic<float>* time_manip = nullptr;
+    };
+    HeadParams head_params_[Looper::kMaxHeads - 1];
     
     Looper looper_;
-    std::vector<float> loop_buf_;
+    size_t pool_headroom_ = 0; // pages registered with the LoopPagePool
+    MappedLoopBuffer mapped_buf_; // used in place of pool pages in long-loop mode
+    SeamFinder seam_finder_;
+    LoopBouncer bouncer_;
+    
+    /** The loop overview the editor draws, safe to call from the message thread.
+        A new one is made whenever the buffer is, so hold on to the pointer
+        rather than the overview itself.
+    */
+    std::shared_ptr<LoopOverview> getOverview() const { return std::atomic_load (&overview_); }
+    
+    // peaks and markers for the editor, swapped in by prepareToPlay and only read by the GUI
+    std::shared_ptr<LoopOverview> overview_;
+    void resetOverview (size_t size);
 
 private:
     //==============================================================================
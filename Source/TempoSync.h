@@ -0,0 +1,87 @@
+/*
+  ==============================================================================
+
+    TempoSync.h
+    Created: 18 Oct 2026 2:41:07pm
+    Author:  Solomon Moulang Lewis
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+/**
+       @brief Works out where the host's beat/bar grid falls in each block,
+              so looper transitions can be quantised to it at sample accuracy.
+*/
+class TempoSync
+{
+public:
+    enum Grid {
+        OFF,
+        BEAT,
+        BAR
+    };
+
+    /** Reads the host position for this block, call once at the start of processBlock.
+        Sync is inactive if the grid is OFF, the host gives no tempo or position,
+        or the transport is stopped, transitions should then happen straight away.
+    */
+    void Update (juce::AudioPlayHead *play_head, double sample_rate, Grid grid)
+    {
+        active_ = false;
+
+        if (grid == OFF || play_head == nullptr)
+            return;
+
+        const auto pos = play_head->getPosition();
+        if (! pos.hasValue() || ! pos->getIsPlaying())
+            return;
+
+        const auto bpm = pos->getBpm();
+        const auto ppq = pos->getPpqPosition();
+        if (! bpm.hasValue() || ! ppq.hasValue() || *bpm <= 0.0)
+            return;
+
+        const auto sig = pos->getTimeSignature().orFallback (juce::AudioPlayHead::TimeSignature{});
+        const double beat_ppq = 4.0 / sig.denominator;
+
+        grid_ppq_ = grid == BAR ? beat_ppq * sig.numerator : beat_ppq;
+        samples_per_ppq_ = sample_rate * 60.0 / *bpm;
+        ppq_ = *ppq;
+        bar_start_ppq_ = pos->getPpqPositionOfLastBarStart().orFallback (0.0);
+
+        active_ = true;
+    }
+
+    bool IsActive() const { return active_; }
+
+    /** Sample offset of the next grid line from the start of this block,
+        0 if the block starts on one
+    */
+    int SamplesToNextGridLine() const
+    {
+        // a line up to half a sample before the block start rounds to its first
+        // sample, the last block rounded it past its end so it hasn't fired yet
+        const double half_sample = 0.5 / (grid_ppq_ * samples_per_ppq_) + 1.0e-9;
+        const double since_bar = ppq_ - bar_start_ppq_;
+        const double lines = std::ceil (since_bar / grid_ppq_ - half_sample);
+        const double next_ppq = bar_start_ppq_ + lines * grid_ppq_;
+
+        return juce::jmax (0, static_cast<int> (std::llround ((next_ppq - ppq_) * samples_per_ppq_)));
+    }
+
+    /** Length of one grid division in samples, fractional so trimmed
+        loops don't drift from the host clock
+    */
+    double SamplesPerGridLine() const { return grid_ppq_ * samples_per_ppq_; }
+
+private:
+    bool active_ = false;
+    double grid_ppq_ = 4.0;
+    double samples_per_ppq_ = 0.0;
+    double ppq_ = 0.0;
+    double bar_start_ppq_ = 0.0;
+};
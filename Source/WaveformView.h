@@ -0,0 +1,139 @@
+/*
+  ==============================================================================
+
+    WaveformView.h
+    Created: 18 Oct 2026 6:12:44pm
+    Author:  Solomon Moulang Lewis
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "looper.h"
+
+/**
+       @brief Draws the recorded loop with its segment grid and read heads.
+            - Peaks come from the processor's LoopOverview, one GetPeaks() per
+              pixel column, the loop buffer itself is never touched
+            - Repaints at 60fps off a timer, every read is a relaxed atomic load
+              so the audio thread is never held up by drawing
+            - Says so for a couple of seconds when a bounce couldn't get the
+              memory it needed
+*/
+class WaveformView  : public juce::Component,
+                      private juce::Timer
+{
+public:
+    using OverviewSource = std::function<std::shared_ptr<LoopOverview>()>;
+
+    explicit WaveformView (OverviewSource source) : source_ (std::move (source))
+    {
+        setOpaque (true);
+        startTimerHz (60);
+    }
+
+    void paint (juce::Graphics& g) override
+    {
+        g.fillAll (juce::Colours::black);
+
+        const auto overview = source_();
+        if (overview == nullptr || overview->Size() == 0)
+            return;
+
+        const auto m = overview->GetMarkers();
+
+        // a new overview starts counting from wherever the looper is
+        if (overview.get() != seen_overview_)
+        {
+            seen_overview_ = overview.get();
+            seen_failures_ = m.failed_bounces;
+        }
+
+        if (m.failed_bounces != seen_failures_)
+        {
+            seen_failures_ = m.failed_bounces;
+            failure_time_ = juce::Time::getMillisecondCounter();
+        }
+
+        if (m.state == Looper::LISTENING || m.loop_length == 0)
+            return;
+
+        const auto bounds = getLocalBounds().toFloat();
+        const int width = getWidth();
+        const float mid = bounds.getCentreY();
+        const float half_height = bounds.getHeight() * 0.5f;
+        const double samples_per_px = static_cast<double> (m.loop_length) / width;
+
+        // x of a buffer index, measured from the start of the loop
+        auto toX = [&] (size_t index)
+        {
+            const size_t from_start = (index + overview->Size() - m.loop_start) % overview->Size();
+            return static_cast<float> (from_start / samples_per_px);
+        };
+
+        // current segment behind the waveform
+        if (m.state == Looper::PLAYING && m.seg_length > 0)
+        {
+            const float x = toX (m.seg_start);
+            const float w = static_cast<float> (m.seg_length / samples_per_px);
+            g.setColour (juce::Colours::white.withAlpha (0.12f));
+            g.fillRect (x, 0.f, w, bounds.getHeight());
+            if (x + w > bounds.getWidth()) // wraps round the end of the loop
+                g.fillRect (0.f, 0.f, x + w - bounds.getWidth(), bounds.getHeight());
+        }
+
+        g.setColour (m.state == Looper::RECORDING ? juce::Colours::indianred : juce::Colours::lightseagreen);
+        for (int px = 0; px < width; px++)
+        {
+            const auto from = static_cast<size_t> (px * samples_per_px);
+            const auto to = static_cast<size_t> ((px + 1) * samples_per_px);
+
+            float lo, hi;
+            overview->GetPeaks (m.loop_start + from, juce::jmax<size_t> (to - from, 1), lo, hi);
+            g.drawVerticalLine (px, mid - hi * half_height, mid - lo * half_height + 1.f);
+        }
+
+        if (failure_time_ != 0 && juce::Time::getMillisecondCounter() - failure_time_ < kFailureMs)
+        {
+            g.setColour (juce::Colours::indianred);
+            g.drawText ("Bounce failed, out of loop memory", getLocalBounds().reduced (6),
+                        juce::Justification::topLeft);
+        }
+
+        if (m.state != Looper::PLAYING)
+            return;
+
+        // equal division grid, slice points aren't published so there's nothing to draw for them
+        if (! m.slices && m.seg_length > 0 && m.seg_length < m.loop_length)
+        {
+            g.setColour (juce::Colours::white.withAlpha (0.3f));
+            for (size_t s = m.seg_length; s < m.loop_length; s += m.seg_length)
+                g.drawVerticalLine (static_cast<int> (s / samples_per_px), 0.f, bounds.getHeight());
+        }
+
+        for (size_t h = 0; h < LoopOverview::kMaxHeads; h++)
+        {
+            if (! m.head_active[h])
+                continue;
+
+            g.setColour (h == 0 ? juce::Colours::white : juce::Colours::orange);
+            g.drawVerticalLine (static_cast<int> (toX (m.head_pos[h])), 0.f, bounds.getHeight());
+        }
+    }
+
+private:
+    void timerCallback() override { repaint(); }
+
+    static constexpr juce::uint32 kFailureMs = 2000;
+
+    OverviewSource source_;
+
+    // failed bounces seen so far, and when the last one was
+    const LoopOverview *seen_overview_ = nullptr;
+    uint32_t seen_failures_ = 0;
+    juce::uint32 failure_time_ = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WaveformView)
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include "dsp.h"
+
+class EnvelopeFollower
+{
+public:
+    /**
+           @brief Peak envelope of a signal, a value a sample, for modulating
+                  params at audio rate from a sidechain.
+                - The loudest channel, full wave rectified, then smoothed with
+                  daisysp::fonepole, on the attack coefficient while the level
+                  rises and the release one while it falls
+                - Works a block at a time, the rectifying is a plain loop over
+                  the channels the compiler vectorises, the one pole after it
+                  runs a sample at a time
+                - Audio thread only, nothing is allocated
+    */
+    void Init (float sample_rate)
+    {
+        sample_rate_ = sample_rate;
+        level_ = 0.f;
+        attack_ms_ = release_ms_ = -1.f;
+        SetTimes (kDefaultAttackMs, kDefaultReleaseMs);
+    }
+
+    /** Attack and release in ms, cheap to call every block */
+    void SetTimes (float attack_ms, float release_ms)
+    {
+        if (attack_ms != attack_ms_)
+        {
+            attack_ms_ = attack_ms;
+            attack_ = Coeff (attack_ms);
+        }
+
+        if (release_ms != release_ms_)
+        {
+            release_ms_ = release_ms;
+            release_ = Coeff (release_ms);
+        }
+    }
+
+    /** Writes the envelope of size samples of in, from sample offset of each
+        of its num_channels channels, to env
+    */
+    void Process (const float *const *in, size_t num_channels, size_t offset, float *env, size_t size)
+    {
+        std::fill (env, env + size, 0.f);
+
+        for (size_t c = 0; c < num_channels; c++)
+        {
+            const float *x = in[c] + offset;
+            for (size_t i = 0; i < size; i++)
+                env[i] = std::max (env[i], std::fabs (x[i]));
+        }
+
+        float level = level_;
+        for (size_t i = 0; i < size; i++)
+        {
+            daisysp::fonepole (level, env[i], env[i] > level ? attack_ : release_);
+            env[i] = level;
+        }
+        level_ = level;
+    }
+
+    float GetLevel() const { return level_; }
+
+private:
+    static constexpr float kDefaultAttackMs = 1.f;
+    static constexpr float kDefaultReleaseMs = 80.f;
+
+    // fonepole's coefficient for a time constant of ms
+    float Coeff (float ms) const
+    {
+        const float samples = ms * 0.001f * sample_rate_;
+        return samples > 1.f ? 1.f / samples : 1.f;
+    }
+
+    float sample_rate_ = 48000.f;
+    float level_ = 0.f;
+
+    float attack_ms_ = -1.f;
+    float release_ms_ = -1.f;
+    float attack_ = 1.f;
+    float release_ = 1.f;
+};
@@ -0,0 +1,293 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "loop_storage.h"
+#include "silence_map.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+class GrainCloud
+{
+public:
+    /**
+           @brief A cloud of short windowed grains read from the loop buffer.
+                - Grains start around a position in a region of the buffer (the
+                  current segment) and read through it at their own rate
+                - A fixed pool of kMaxGrains, held structure-of-arrays and kept
+                  dense so finished grains are swapped out, nothing is allocated
+                - Rendered a chunk at a time, each grain reads its span of the
+                  buffer once per chunk then is interpolated, and windowed and
+                  summed into the output with SIMD
+                - A grain reading only silent blocks of the buffer is skipped over
+    */
+    using Phase = int64_t;
+    static constexpr size_t kMaxGrains = 256;
+    static constexpr float kMinRate = 0.25f;
+    static constexpr float kMaxRate = 4.f;
+
+    void Reset()
+    {
+        num_grains_ = 0;
+        countdown_ = 0.f;
+    }
+
+    /** Grains start in the len long region of the buffer from start */
+    void SetRegion (Phase start, Phase len)
+    {
+        region_start_ = start;
+        region_len_ = std::max (len, kOne);
+    }
+
+    /** Where grains start along the region, 0 to 1 */
+    void SetPosition (float position) { position_ = std::min (std::max (position, 0.f), 1.f); }
+
+    void SetGrainSize (size_t samples) { grain_size_ = std::max (samples, static_cast<size_t> (2)); }
+
+    /** Playback rate of new grains, negative to play them backwards */
+    void SetRate (float rate)
+    {
+        const float mag = std::min (std::max (std::fabs (rate), kMinRate), kMaxRate);
+        rate_ = rate < 0.f ? -mag : mag;
+    }
+
+    /** Average samples between new grains, they're spread around it at random */
+    void SetInterval (float samples) { interval_ = std::max (samples, 1.f); }
+
+    size_t NumGrains() const { return num_grains_; }
+
+    /** Where in the buffer new grains start reading, before they're scattered,
+        and where they've read to when they finish
+    */
+    void GetReadSpan (Phase &start, Phase &end) const
+    {
+        start = region_start_ + static_cast<Phase> (position_ * static_cast<float> (region_len_ >> kFracBits)) * kOne;
+        end = start + static_cast<Phase> (static_cast<float> (grain_size_) * rate_) * kOne;
+
+        if (buffer_size_ > 0)
+        {
+            start = (start % buffer_size_ + buffer_size_) % buffer_size_;
+            end = (end % buffer_size_ + buffer_size_) % buffer_size_;
+        }
+    }
+
+    /** Renders size samples of the cloud into out, replacing what was there */
+    void Process (LoopStorage &storage, const SilenceMap &silence, float *out, size_t size)
+    {
+        buffer_size_ = static_cast<Phase> (storage.Size()) << kFracBits;
+
+        for (size_t i = 0; i < size; i += kChunk)
+            RenderChunk (storage, silence, out + i, std::min (kChunk, size - i));
+    }
+
+private:
+    static constexpr int kFracBits = 32;
+    static constexpr Phase kOne = static_cast<Phase> (1) << kFracBits;
+    static constexpr Phase kFracMask = kOne - 1;
+    static constexpr size_t kChunk = 64;
+    static constexpr size_t kMaxSpan = static_cast<size_t> (kChunk * kMaxRate) + 2;
+
+    void RenderChunk (LoopStorage &storage, const SilenceMap &silence, float *out, size_t n)
+    {
+        std::fill (out, out + n, 0.f);
+
+        // grains due in this chunk start part way through it
+        while (countdown_ < static_cast<float> (n))
+        {
+            Spawn (static_cast<int32_t> (countdown_));
+            countdown_ += interval_ * (0.5f + Random());
+        }
+        countdown_ -= static_cast<float> (n);
+
+        size_t g = 0;
+        while (g < num_grains_)
+        {
+            RenderGrain (storage, silence, g, out, n);
+
+            if (age_[g] < len_[g])
+            {
+                g++;
+                continue;
+            }
+
+            // finished, the last grain takes its place
+            num_grains_--;
+            pos_[g] = pos_[num_grains_];
+            inc_[g] = inc_[num_grains_];
+            age_[g] = age_[num_grains_];
+            len_[g] = len_[num_grains_];
+            inv_len_[g] = inv_len_[num_grains_];
+            gain_[g] = gain_[num_grains_];
+        }
+    }
+
+    void Spawn (int32_t delay)
+    {
+        if (num_grains_ == kMaxGrains)
+            return;
+
+        // scattered up to half a grain either side of the position, kept inside the region
+        const float scatter = (Random() - 0.5f) * static_cast<float> (grain_size_);
+        Phase offset = static_cast<Phase> (position_ * static_cast<float> (region_len_ >> kFracBits) + scatter) * kOne;
+        offset %= region_len_;
+        if (offset < 0)
+            offset += region_len_;
+
+        Phase pos = region_start_ + offset;
+        if (pos >= buffer_size_)
+            pos -= buffer_size_;
+
+        const size_t g = num_grains_++;
+        pos_[g] = pos;
+        inc_[g] = static_cast<Phase> (rate_ * static_cast<float> (kOne));
+        age_[g] = -delay;
+        len_[g] = static_cast<int32_t> (grain_size_);
+        inv_len_[g] = 1.f / static_cast<float> (grain_size_);
+
+        // overlapping grains are uncorrelated, so they add up by power. Each
+        // grain keeps the gain for the overlap it started in, so changing the
+        // size or density doesn't rescale the grains already playing
+        const float overlap = static_cast<float> (grain_size_) / interval_;
+        gain_[g] = 1.f / std::sqrt (std::max (overlap, 1.f));
+    }
+
+    void RenderGrain (LoopStorage &storage, const SilenceMap &silence, size_t g, float *out, size_t n)
+    {
+        const int32_t age = age_[g];
+        const size_t from = static_cast<size_t> (std::max (-age, 0));
+        const size_t to = static_cast<size_t> (std::min (static_cast<int32_t> (n), len_[g] - age));
+        age_[g] = age + static_cast<int32_t> (n);
+
+        if (to <= from)
+            return;
+
+        const size_t count = to - from;
+        const Phase inc = inc_[g];
+        const Phase pos = pos_[g];
+
+        // the samples read this chunk, plus one for the interpolation
+        const Phase last = pos + inc * static_cast<Phase> (count - 1);
+        const Phase lo = std::min (pos, last) >> kFracBits;
+        const size_t span = static_cast<size_t> ((std::max (pos, last) >> kFracBits) - lo) + 2;
+
+        if (! silence.IsSilent (lo, lo + static_cast<int64_t> (span) - 1))
+        {
+            ReadWrapped (storage, lo, span);
+
+            Phase p = pos - lo * kOne;
+            for (size_t i = 0; i < count; i++)
+            {
+                const size_t idx = static_cast<size_t> (p >> kFracBits);
+                const float frac = static_cast<float> (static_cast<uint32_t> (p & kFracMask)) * (1.f / static_cast<float> (kOne));
+                grain_[i] = span_[idx] + (span_[idx + 1] - span_[idx]) * frac;
+                p += inc;
+            }
+
+            Window (out + from, grain_, static_cast<float> (age + static_cast<int32_t> (from)) * inv_len_[g],
+                    inv_len_[g], count, gain_[g]);
+        }
+
+        Phase next = pos + inc * static_cast<Phase> (count);
+        if (next >= buffer_size_)
+            next -= buffer_size_;
+        else if (next < 0)
+            next += buffer_size_;
+        pos_[g] = next;
+    }
+
+    // fills span_ with len samples from index first, which may be off either end of the buffer
+    void ReadWrapped (LoopStorage &storage, int64_t first, size_t len)
+    {
+        const int64_t size = static_cast<int64_t> (storage.Size());
+        size_t pos = static_cast<size_t> (((first % size) + size) % size);
+        float *dst = span_;
+
+        while (len > 0)
+        {
+            const size_t run = std::min (len, static_cast<size_t> (size) - pos);
+            storage.ReadRun (pos, dst, run);
+            dst += run;
+            len -= run;
+            pos = 0;
+        }
+    }
+
+    /** out += in * w(t), w(t) = (4t(1 - t))^2 from t0 in steps of dt. Close to a
+        Hann window but a polynomial, so four grain samples are windowed at once.
+    */
+    static void Window (float *out, const float *in, float t0, float dt, size_t n, float gain)
+    {
+        size_t i = 0;
+#if defined(__SSE__) || defined(_M_X64)
+        const __m128 four = _mm_set1_ps (4.f);
+        const __m128 one = _mm_set1_ps (1.f);
+        const __m128 g = _mm_set1_ps (gain);
+        const __m128 step = _mm_set1_ps (4.f * dt);
+        __m128 t = _mm_add_ps (_mm_set1_ps (t0), _mm_mul_ps (_mm_set_ps (3.f, 2.f, 1.f, 0.f), _mm_set1_ps (dt)));
+        for (const size_t vec_end = n - n % 4; i < vec_end; i += 4)
+        {
+            const __m128 x = _mm_mul_ps (_mm_mul_ps (four, t), _mm_sub_ps (one, t));
+            const __m128 w = _mm_mul_ps (_mm_mul_ps (x, x), g);
+            _mm_storeu_ps (out + i, _mm_add_ps (_mm_loadu_ps (out + i), _mm_mul_ps (_mm_loadu_ps (in + i), w)));
+            t = _mm_add_ps (t, step);
+        }
+#elif defined(__ARM_NEON)
+        const float32x4_t four = vdupq_n_f32 (4.f);
+        const float32x4_t one = vdupq_n_f32 (1.f);
+        const float32x4_t step = vdupq_n_f32 (4.f * dt);
+        const float lanes[4] = {t0, t0 + dt, t0 + 2.f * dt, t0 + 3.f * dt};
+        float32x4_t t = vld1q_f32 (lanes);
+        for (const size_t vec_end = n - n % 4; i < vec_end; i += 4)
+        {
+            const float32x4_t x = vmulq_f32 (vmulq_f32 (four, t), vsubq_f32 (one, t));
+            const float32x4_t w = vmulq_n_f32 (vmulq_f32 (x, x), gain);
+            vst1q_f32 (out + i, vmlaq_f32 (vld1q_f32 (out + i), vld1q_f32 (in + i), w));
+            t = vaddq_f32 (t, step);
+        }
+#endif
+        for (; i < n; i++)
+        {
+            const float t = t0 + static_cast<float> (i) * dt;
+            const float x = 4.f * t * (1.f - t);
+            out[i] += in[i] * x * x * gain;
+        }
+    }
+
+    // xorshift, uniform in [0, 1)
+    float Random()
+    {
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        return static_cast<float> (seed_ >> 8) * (1.f / 16777216.f);
+    }
+
+    // grain state, the first num_grains_ of each are playing
+    Phase pos_[kMaxGrains] = {};
+    Phase inc_[kMaxGrains] = {};
+    int32_t age_[kMaxGrains] = {};
+    int32_t len_[kMaxGrains] = {};
+    float inv_len_[kMaxGrains] = {};
+    float gain_[kMaxGrains] = {};
+    size_t num_grains_ = 0;
+
+    Phase region_start_ = 0;
+    Phase region_len_ = kOne;
+    Phase buffer_size_ = kOne;
+    float position_ = 0.f;
+    size_t grain_size_ = 4096;
+    float rate_ = 1.f;
+    float interval_ = 1024.f;
+
+    float countdown_ = 0.f;
+    uint32_t seed_ = 0x9e3779b9u;
+
+    float span_[kMaxSpan] = {};
+    float grain_[kChunk] = {};
+};
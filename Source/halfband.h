@@ -0,0 +1,28 @@
+#pragma once
+
+class Halfband
+{
+public:
+    /**
+           @brief 31 tap half band low pass (Kaiser window, beta 7). Cuts at a
+                  quarter of the sample rate, the new Nyquist when every other
+                  sample is skipped.
+                - Only the odd taps are stored, the even taps are 0 apart from
+                  the centre
+                - Process() reads kHalfTaps samples either side of x
+    */
+    static constexpr int kHalfTaps = 15;
+    static constexpr float kCentre = 0.499971497f;
+    static constexpr float kTaps[8] = {
+        0.313737466f, -0.0930905437f, 0.0439889791f, -0.0215919023f,
+        0.00980408201f, -0.00377247227f, 0.00106450368f, -0.000125861305f
+    };
+
+    static inline float Process (const float *x)
+    {
+        float y = kCentre * x[0];
+        for (int k = 0; k < 8; k++)
+            y += kTaps[k] * (x[-(2 * k + 1)] + x[2 * k + 1]);
+        return y;
+    }
+};
@@ -0,0 +1,325 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "halfband.h"
+#include "loop_pool.h"
+#include "loop_storage.h"
+#include "sample_format.h"
+
+class LoopBouncer
+{
+public:
+    /**
+           @brief Renders a segment of the loop, warped the way a head plays it,
+                  into a new loop on a worker thread.
+                - The audio thread pins the loop's pages and submits the segment,
+                  the worker reads them and writes the bounce into fresh pages
+                  claimed from the pool, faster than real time
+                - Reads the same way playback does, interpolated between samples
+                  and through the half band filter for whole sample skips
+                - The result is handed back through an atomic state, the audio
+                  thread polls for it once per block, adopts the pages as its page
+                  table in one go and never waits
+                - Registers a whole buffer's worth of pages with the pool while
+                  started, so the pages for a bounce are there when it's asked for
+    */
+    using Phase = int64_t;
+
+    struct Job {
+        Phase seg_start = 0;     // first position of the segment in the buffer
+        Phase seg_len = 0;
+        Phase start_offset = 0;  // where along the segment the pass starts
+        Phase inc = kOne;
+        bool band_limit = true;  // whole sample skips read through the half band filter
+        size_t length = 0;       // samples to render, at most the buffer size
+    };
+
+    LoopBouncer() {}
+    ~LoopBouncer() { Stop(); }
+    LoopBouncer (const LoopBouncer&) = delete;
+    LoopBouncer& operator= (const LoopBouncer&) = delete;
+
+    /** Sizes the bouncer for a loop of size samples in pool pages of format,
+        the same as the looper's storage, reserves the pages for a bounce with
+        the pool and starts the worker. Don't call from the audio thread.
+    */
+    void Start (LoopPagePool &pool, LoopStorage::StorageFormat format, size_t size)
+    {
+        Stop();
+
+        pool_ = &pool;
+        format_ = format;
+        size_ = size;
+        page_samples_ = LoopStorage::PageSamples (format);
+
+        const size_t num_pages = (size + page_samples_ - 1) / page_samples_;
+        source_.assign (num_pages, nullptr);
+        pages_.assign (num_pages, LoopPagePool::kNoPage);
+
+        // the pool keeps only a couple of seconds of pages free per client
+        // otherwise, and the worker claims them far faster than it refills
+        reserved_pages_ = num_pages;
+        pool.AddClient (reserved_pages_);
+
+        running_.store (true);
+        worker_ = std::thread ([this] { Run(); });
+    }
+
+    /** Stops the worker, a result it left behind goes back to the pool */
+    void Stop()
+    {
+        running_.store (false);
+
+        if (worker_.joinable())
+            worker_.join();
+
+        ReleasePages();
+        state_.store (IDLE);
+
+        if (reserved_pages_ > 0)
+        {
+            pool_->RemoveClient (reserved_pages_);
+            reserved_pages_ = 0;
+        }
+    }
+
+    //====================================================
+    // audio thread
+
+    bool IsIdle() const { return state_.load (std::memory_order_acquire) == IDLE; }
+
+    /** The page table to read from, fill with LoopStorage::PinnedPages() before Submit() */
+    const char** SourcePages() { return source_.data(); }
+
+    void Submit (uint32_t id, const Job &job)
+    {
+        request_id_ = id;
+        job_ = job;
+        state_.store (REQUESTED, std::memory_order_release);
+    }
+
+    /** True once a submitted bounce has finished, whether it worked or not.
+        Collect it with TakeResult() or Discard().
+    */
+    bool IsDone() const { return state_.load (std::memory_order_acquire) == DONE; }
+
+    /** True if the finished bounce for request id ran out of pool pages */
+    bool Failed (uint32_t id) const { return request_id_ == id && ! succeeded_; }
+
+    /** The finished bounce if it was for request id and the pool had the pages
+        for it, the caller owns the pages from here on. Otherwise returns false
+        and they go back to the pool.
+    */
+    bool TakeResult (uint32_t id, const uint32_t *&pages, size_t &num_pages)
+    {
+        if (request_id_ != id || ! succeeded_)
+        {
+            Discard();
+            return false;
+        }
+
+        pages = pages_.data();
+        num_pages = num_result_pages_;
+        num_result_pages_ = 0;
+        state_.store (IDLE, std::memory_order_release);
+        return true;
+    }
+
+    void Discard()
+    {
+        ReleasePages();
+        state_.store (IDLE, std::memory_order_release);
+    }
+
+private:
+    enum State {
+        IDLE,
+        REQUESTED,
+        BUSY,
+        DONE
+    };
+
+    static constexpr int kFracBits = 32;
+    static constexpr Phase kOne = static_cast<Phase> (1) << kFracBits;
+    static constexpr Phase kFracMask = kOne - 1;
+    static constexpr size_t kChunk = 256;
+    static constexpr int kClaimRetries = 500; // 2ms apart, a second for the pool to refill
+
+    void Run()
+    {
+        while (running_.load())
+        {
+            int expected = REQUESTED;
+            if (state_.compare_exchange_strong (expected, BUSY, std::memory_order_acquire))
+            {
+                succeeded_ = Render();
+                if (! succeeded_)
+                    ReleasePages();
+                state_.store (DONE, std::memory_order_release);
+                continue;
+            }
+
+            std::this_thread::sleep_for (std::chrono::milliseconds (2));
+        }
+    }
+
+    // the job's pass over its segment, a chunk at a time into pages claimed as it goes
+    bool Render()
+    {
+        const Job job = job_;
+        const Phase step = job.inc < 0 ? -job.inc : job.inc;
+        const bool decimate = job.band_limit && (step & kFracMask) == 0 && step > kOne;
+
+        float out[kChunk];
+        Phase offset = job.start_offset;
+
+        for (size_t i = 0; i < job.length; i += kChunk)
+        {
+            const size_t n = std::min (kChunk, job.length - i);
+
+            for (size_t k = 0; k < n; k++)
+            {
+                Phase pos = job.seg_start + offset;
+                if (pos >= ToPhase (size_))
+                    pos -= ToPhase (size_);
+
+                const int64_t idx = pos >> kFracBits;
+                const float frac = static_cast<float> (static_cast<uint32_t> (pos & kFracMask)) * (1.f / static_cast<float> (kOne));
+
+                // a pass carries its overshoot round the segment like a head does
+                Phase next = offset + job.inc;
+                const bool wraps = next >= job.seg_len || next < 0;
+                if (next >= job.seg_len)
+                    next -= job.seg_len;
+                else if (next < 0)
+                    next += job.seg_len;
+
+                // and the sample a head wraps on is read unfiltered, the same as playback
+                float a, b;
+                if (decimate && ! wraps)
+                {
+                    a = Filtered (idx);
+                    b = frac != 0.f ? Filtered (idx + 1) : a;
+                }
+                else
+                {
+                    a = Sample (idx);
+                    b = frac != 0.f ? Sample (idx + 1) : a;
+                }
+                out[k] = a + (b - a) * frac;
+                offset = next;
+            }
+
+            if (! Write (i, out, n))
+                return false;
+        }
+
+        // the rest of the last page, recycled pages still hold whatever used them last
+        const size_t end = std::min (num_result_pages_ * page_samples_, size_);
+        for (size_t i = job.length; i < end; i += kChunk)
+        {
+            float zeros[kChunk] = {};
+            if (! Write (i, zeros, std::min (kChunk, end - i)))
+                return false;
+        }
+        return true;
+    }
+
+    float Filtered (int64_t idx) const
+    {
+        float x[2 * Halfband::kHalfTaps + 1];
+        for (int k = -Halfband::kHalfTaps; k <= Halfband::kHalfTaps; k++)
+            x[k + Halfband::kHalfTaps] = Sample (idx + k);
+        return Halfband::Process (x + Halfband::kHalfTaps);
+    }
+
+    // sample idx of the pinned loop, wrapping round either end of the buffer
+    float Sample (int64_t idx) const
+    {
+        const int64_t size = static_cast<int64_t> (size_);
+        const size_t pos = static_cast<size_t> (((idx % size) + size) % size);
+        const char *page = source_[pos / page_samples_];
+        const size_t i = pos % page_samples_;
+
+        if (format_ == LoopStorage::FLOAT32)
+            return reinterpret_cast<const float*> (page)[i];
+        return sample_format::HalfToFloat (reinterpret_cast<const uint16_t*> (page)[i]);
+    }
+
+    // writes n samples from pos, claiming pages as it reaches them
+    bool Write (size_t pos, const float *src, size_t n)
+    {
+        while (n > 0)
+        {
+            const size_t p = pos / page_samples_;
+            if (p >= num_result_pages_)
+            {
+                const uint32_t id = Claim();
+                if (id == LoopPagePool::kNoPage)
+                    return false;
+                pages_[num_result_pages_++] = id;
+            }
+
+            char *page = pool_->GetPage (pages_[p]);
+            const size_t i = pos % page_samples_;
+            const size_t len = std::min (n, page_samples_ - i);
+
+            if (format_ == LoopStorage::FLOAT32)
+                std::copy (src, src + len, reinterpret_cast<float*> (page) + i);
+            else
+                sample_format::FloatToHalf (src, reinterpret_cast<uint16_t*> (page) + i, len);
+
+            pos += len;
+            src += len;
+            n -= len;
+        }
+        return true;
+    }
+
+    // a page from the pool, waiting on the refill thread if another client
+    // has taken the free ones, the worker can block
+    uint32_t Claim()
+    {
+        for (int tries = 0; running_.load(); tries++)
+        {
+            const uint32_t id = pool_->Claim();
+            if (id != LoopPagePool::kNoPage || tries == kClaimRetries)
+                return id;
+
+            std::this_thread::sleep_for (std::chrono::milliseconds (2));
+        }
+        return LoopPagePool::kNoPage;
+    }
+
+    void ReleasePages()
+    {
+        for (size_t p = 0; p < num_result_pages_; p++)
+            pool_->Release (pages_[p]);
+        num_result_pages_ = 0;
+    }
+
+    static constexpr Phase ToPhase (size_t samples) { return static_cast<Phase> (samples) << kFracBits; }
+
+    LoopPagePool *pool_ = nullptr;
+    LoopStorage::StorageFormat format_ = LoopStorage::FLOAT32;
+    size_t size_ = 0;
+    size_t page_samples_ = 1;
+    size_t reserved_pages_ = 0; // registered with the pool as headroom
+
+    std::thread worker_;
+    std::atomic<bool> running_ {false};
+    std::atomic<int> state_ {IDLE};
+
+    // owned by whichever side the state says, handed over with state_
+    uint32_t request_id_ = 0;
+    Job job_;
+    std::vector<const char*> source_;
+    std::vector<uint32_t> pages_;
+    size_t num_result_pages_ = 0;
+    bool succeeded_ = false;
+};
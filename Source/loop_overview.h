@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class LoopOverview
+{
+public:
+    /**
+           @brief A min/max peak pyramid of the loop buffer and the looper's markers,
+                  for drawing the loop without touching the audio.
+                - Level 0 holds one min/max pair per kBinSize samples, each level
+                  above combines kFanOut bins of the one below, up to a single bin
+                - Updated while recording a bin at a time, only the bins being
+                  written and the ones above them are touched
+                - Every peak and marker is a relaxed atomic, the GUI reads them
+                  whenever it likes and nothing ever waits on a lock
+    */
+    static constexpr size_t kBinSize = 64;
+    static constexpr size_t kFanOut = 4;
+    static constexpr size_t kMaxHeads = 4;
+
+    struct Markers {
+        int state = 0;
+        size_t loop_start = 0;
+        size_t loop_length = 0;
+        size_t seg_start = 0;
+        size_t seg_length = 0;
+        bool slices = false;
+        uint32_t failed_bounces = 0;
+        size_t head_pos[kMaxHeads] = {};
+        bool head_active[kMaxHeads] = {};
+    };
+
+    /** Allocates the pyramid for a buffer of size samples, don't call from the audio thread */
+    explicit LoopOverview (size_t size) : size_ (size)
+    {
+        size_t total = 0;
+        size_t bins = NumBinsFor (size, kBinSize);
+
+        while (num_levels_ < kMaxLevels)
+        {
+            offsets_[num_levels_] = total;
+            counts_[num_levels_] = bins;
+            total += bins;
+            num_levels_++;
+
+            if (bins <= 1)
+                break;
+            bins = (bins + kFanOut - 1) / kFanOut;
+        }
+
+        peaks_.reset (new std::atomic<uint32_t>[total]);
+        for (size_t i = 0; i < total; i++)
+            peaks_[i].store (0, std::memory_order_relaxed);
+    }
+
+    //====================================================
+    // audio thread
+
+    /** Starts a new pass, the first bin written doesn't merge with what was there */
+    void BeginRecording() { cur_bin_ = kNoBin; }
+
+    inline void Write (size_t pos, float val)
+    {
+        const size_t bin = pos / kBinSize;
+
+        if (bin != cur_bin_)
+        {
+            if (cur_bin_ != kNoBin)
+                Publish();
+
+            cur_bin_ = bin;
+            cur_min_ = val;
+            cur_max_ = val;
+            return;
+        }
+
+        cur_min_ = std::min (cur_min_, val);
+        cur_max_ = std::max (cur_max_, val);
+    }
+
+    /** Publishes the bin being written so far, call at the end of each recorded block */
+    void Flush()
+    {
+        if (cur_bin_ != kNoBin)
+            Publish();
+    }
+
+    void SetMarkers (const Markers &m)
+    {
+        state_.store (m.state, std::memory_order_relaxed);
+        loop_start_.store (m.loop_start, std::memory_order_relaxed);
+        loop_length_.store (m.loop_length, std::memory_order_relaxed);
+        seg_start_.store (m.seg_start, std::memory_order_relaxed);
+        seg_length_.store (m.seg_length, std::memory_order_relaxed);
+        slices_.store (m.slices, std::memory_order_relaxed);
+        failed_bounces_.store (m.failed_bounces, std::memory_order_relaxed);
+
+        for (size_t h = 0; h < kMaxHeads; h++)
+        {
+            head_pos_[h].store (m.head_pos[h], std::memory_order_relaxed);
+            head_active_[h].store (m.head_active[h], std::memory_order_relaxed);
+        }
+    }
+
+    //====================================================
+    // GUI thread
+
+    size_t Size() const { return size_; }
+
+    Markers GetMarkers() const
+    {
+        Markers m;
+        m.state = state_.load (std::memory_order_relaxed);
+        m.loop_start = loop_start_.load (std::memory_order_relaxed);
+        m.loop_length = loop_length_.load (std::memory_order_relaxed);
+        m.seg_start = seg_start_.load (std::memory_order_relaxed);
+        m.seg_length = seg_length_.load (std::memory_order_relaxed);
+        m.slices = slices_.load (std::memory_order_relaxed);
+        m.failed_bounces = failed_bounces_.load (std::memory_order_relaxed);
+
+        for (size_t h = 0; h < kMaxHeads; h++)
+        {
+            m.head_pos[h] = head_pos_[h].load (std::memory_order_relaxed);
+            m.head_active[h] = head_active_[h].load (std::memory_order_relaxed);
+        }
+        return m;
+    }
+
+    /** Min and max of the len samples from start, wrapping round the end of the buffer.
+        Reads the coarsest level with at least kFanOut^2 bins across len, so the
+        cost doesn't depend on how much of the buffer a pixel covers and the
+        bins overhanging either end add little.
+    */
+    void GetPeaks (size_t start, size_t len, float &lo, float &hi) const
+    {
+        lo = 0.f;
+        hi = 0.f;
+        if (len == 0 || size_ == 0)
+            return;
+
+        size_t level = 0;
+        size_t bin_size = kBinSize;
+        while (level + 1 < num_levels_ && bin_size * kFanOut * kFanOut * kFanOut <= len)
+        {
+            bin_size *= kFanOut;
+            level++;
+        }
+
+        int32_t min_q = INT16_MAX, max_q = INT16_MIN;
+        start %= size_;
+        len = std::min (len, size_);
+
+        while (len > 0)
+        {
+            // split where the range wraps round the end of the buffer
+            const size_t run = std::min (len, size_ - start);
+            const size_t first = start / bin_size;
+            const size_t last = (start + run - 1) / bin_size;
+
+            for (size_t b = first; b <= last; b++)
+            {
+                const uint32_t p = peaks_[offsets_[level] + b].load (std::memory_order_relaxed);
+                min_q = std::min<int32_t> (min_q, UnpackMin (p));
+                max_q = std::max<int32_t> (max_q, UnpackMax (p));
+            }
+
+            start = 0;
+            len -= run;
+        }
+
+        lo = static_cast<float> (min_q) * (1.f / 32767.f);
+        hi = static_cast<float> (max_q) * (1.f / 32767.f);
+    }
+
+private:
+    static constexpr size_t kMaxLevels = 24;
+    static constexpr size_t kNoBin = ~static_cast<size_t> (0);
+
+    static size_t NumBinsFor (size_t size, size_t bin_size) { return (size + bin_size - 1) / bin_size; }
+
+    static int16_t Quantise (float v)
+    {
+        return static_cast<int16_t> (std::lround (std::min (std::max (v, -1.f), 1.f) * 32767.f));
+    }
+
+    static uint32_t Pack (int32_t lo, int32_t hi)
+    {
+        return (static_cast<uint32_t> (static_cast<uint16_t> (hi)) << 16) | static_cast<uint16_t> (lo);
+    }
+    static int16_t UnpackMin (uint32_t p) { return static_cast<int16_t> (p & 0xffffu); }
+    static int16_t UnpackMax (uint32_t p) { return static_cast<int16_t> (p >> 16); }
+
+    // stores the current bin and rebuilds the bins above it
+    void Publish()
+    {
+        size_t bin = cur_bin_;
+        peaks_[offsets_[0] + bin].store (Pack (Quantise (cur_min_), Quantise (cur_max_)),
+                                         std::memory_order_relaxed);
+
+        for (size_t level = 1; level < num_levels_; level++)
+        {
+            bin /= kFanOut;
+
+            const size_t first = bin * kFanOut;
+            const size_t last = std::min (first + kFanOut, counts_[level - 1]);
+            int32_t lo = INT16_MAX, hi = INT16_MIN;
+
+            for (size_t b = first; b < last; b++)
+            {
+                const uint32_t p = peaks_[offsets_[level - 1] + b].load (std::memory_order_relaxed);
+                lo = std::min<int32_t> (lo, UnpackMin (p));
+                hi = std::max<int32_t> (hi, UnpackMax (p));
+            }
+
+            peaks_[offsets_[level] + bin].store (Pack (lo, hi), std::memory_order_relaxed);
+        }
+    }
+
+    size_t size_ = 0;
+    size_t num_levels_ = 0;
+    size_t offsets_[kMaxLevels] = {};
+    size_t counts_[kMaxLevels] = {};
+    std::unique_ptr<std::atomic<uint32_t>[]> peaks_;
+
+    // audio thread only
+    size_t cur_bin_ = kNoBin;
+    float cur_min_ = 0.f;
+    float cur_max_ = 0.f;
+
+    std::atomic<int> state_ {0};
+    std::atomic<size_t> loop_start_ {0};
+    std::atomic<size_t> loop_length_ {0};
+    std::atomic<size_t> seg_start_ {0};
+    std::atomic<size_t> seg_length_ {0};
+    std::atomic<bool> slices_ {false};
+    std::atomic<uint32_t> failed_bounces_ {0};
+    std::atomic<size_t> head_pos_[kMaxHeads] {};
+    std::atomic<bool> head_active_[kMaxHeads] {};
+};
@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class LoopPagePool
+{
+public:
+    /**
+           @brief Process wide pool of fixed size loop memory pages, shared by every
+                  looper instance so memory is only held for what has been recorded.
+                - Claim() / Release() are lock-free and never allocate, safe on the audio thread
+                - Each client registers the headroom it needs, a refill thread tops the
+                  free list back up to the total headroom off the audio thread
+                - Pages are never handed back to the OS, only back to the free list
+    */
+    static constexpr size_t kPageBytes = 1 << 16;
+    static constexpr uint32_t kNoPage = ~static_cast<uint32_t> (0);
+
+    static LoopPagePool& Instance()
+    {
+        static LoopPagePool pool;
+        return pool;
+    }
+
+    ~LoopPagePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            ++generation_;
+        }
+        refill_cv_.notify_all();
+
+        if (refill_thread_.joinable())
+            refill_thread_.join();
+    }
+
+    /** Registers headroom_pages that should always be free for this client and
+        allocates them straight away. Don't call from the audio thread.
+    */
+    void AddClient (size_t headroom_pages)
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+
+        headroom_ += headroom_pages;
+        Grow();
+
+        if (clients_++ == 0)
+            refill_thread_ = std::thread ([this, gen = ++generation_] { RunRefill (gen); });
+    }
+
+    void RemoveClient (size_t headroom_pages)
+    {
+        std::thread finished;
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            headroom_ -= headroom_pages;
+
+            if (--clients_ > 0)
+                return;
+
+            ++generation_;
+            finished = std::move (refill_thread_);
+        }
+        refill_cv_.notify_all();
+
+        if (finished.joinable())
+            finished.join();
+    }
+
+    /** Pops a free page, kNoPage if the pool has run dry. Lock-free. */
+    uint32_t Claim()
+    {
+        uint64_t head = head_.load (std::memory_order_acquire);
+
+        while (true)
+        {
+            const uint32_t top = static_cast<uint32_t> (head);
+            if (top == 0)
+                return kNoPage;
+
+            const uint32_t next = next_[top - 1].load (std::memory_order_relaxed);
+            if (head_.compare_exchange_weak (head, Tagged (head, next),
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_acquire))
+            {
+                num_free_.fetch_sub (1, std::memory_order_relaxed);
+                return top - 1;
+            }
+        }
+    }
+
+    /** Pushes a page back on the free list. Lock-free. */
+    void Release (uint32_t page)
+    {
+        uint64_t head = head_.load (std::memory_order_relaxed);
+        do
+        {
+            next_[page].store (static_cast<uint32_t> (head), std::memory_order_relaxed);
+        }
+        while (! head_.compare_exchange_weak (head, Tagged (head, page + 1),
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+
+        num_free_.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    char* GetPage (uint32_t page) const
+    {
+        return chunks_[page / kPagesPerChunk].load (std::memory_order_acquire)
+            + (page % kPagesPerChunk) * kPageBytes;
+    }
+
+    /** A shared read only page of silence, for page table entries with nothing recorded */
+    static char* ZeroPage()
+    {
+        alignas (64) static const char zero[kPageBytes] = {};
+        return const_cast<char*> (zero);
+    }
+
+    size_t NumFree() const { return static_cast<size_t> (num_free_.load (std::memory_order_relaxed)); }
+
+private:
+    LoopPagePool() : next_ (new std::atomic<uint32_t>[kMaxPages]) {}
+
+    // the head packs a 32 bit ABA tag above the (index + 1) of the top page
+    static uint64_t Tagged (uint64_t prev_head, uint32_t top)
+    {
+        return (((prev_head >> 32) + 1) << 32) | top;
+    }
+
+    // allocates chunks until the free list covers the registered headroom,
+    // mutex_ must be held
+    void Grow()
+    {
+        while (NumFree() < headroom_ && num_chunks_ < kMaxChunks)
+        {
+            auto mem = std::make_unique<char[]> (kPagesPerChunk * kPageBytes);
+            chunks_[num_chunks_].store (mem.get(), std::memory_order_release);
+            storage_.push_back (std::move (mem));
+
+            for (uint32_t i = 0; i < kPagesPerChunk; i++)
+                Release (static_cast<uint32_t> (num_chunks_ * kPagesPerChunk + i));
+
+            num_chunks_++;
+        }
+    }
+
+    void RunRefill (uint64_t generation)
+    {
+        std::unique_lock<std::mutex> lock (mutex_);
+
+        while (generation == generation_)
+        {
+            Grow();
+            refill_cv_.wait_for (lock, std::chrono::milliseconds (10));
+        }
+    }
+
+    static constexpr uint32_t kPagesPerChunk = 16;
+    static constexpr size_t kMaxChunks = 16384; // 16 GiB
+    static constexpr size_t kMaxPages = kMaxChunks * kPagesPerChunk;
+
+    std::atomic<uint64_t> head_ {0};
+    std::atomic<int64_t> num_free_ {0};
+    std::unique_ptr<std::atomic<uint32_t>[]> next_;
+    std::atomic<char*> chunks_[kMaxChunks] {};
+
+    // everything below is only touched off the audio thread, under mutex_
+    std::mutex mutex_;
+    std::condition_variable refill_cv_;
+    std::thread refill_thread_;
+    uint64_t generation_ = 0;
+    size_t clients_ = 0;
+    size_t headroom_ = 0;
+    size_t num_chunks_ = 0;
+    std::vector<std::unique_ptr<char[]>> storage_;
+};
@@ -0,0 +1,364 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "loop_pool.h"
+#include "sample_format.h"
+
+class LoopStorage
+{
+public:
+    /**
+           @brief Loop sample memory addressed through a page table, either:
+                - A contiguous block of memory owned by the caller (e.g. a mapped file)
+                - Pages claimed from a LoopPagePool as recording reaches them.
+                  Unrecorded pages point at the pool's shared zero page, so
+                  reads never branch and only the first write to a page claims it
+                - Pool backed page tables can be snapshotted, the snapshot shares
+                  every page and the first write to a shared page copies it, so
+                  keeping a snapshot only costs the pages written since
+                - The page table can be pinned for another thread to read, none
+                  of its pages are released or written until it's unpinned
+    */
+    enum StorageFormat {
+        FLOAT32,
+        FLOAT16
+    };
+
+    static constexpr size_t kMaxSnapshots = 8;
+
+    LoopStorage() {}
+    ~LoopStorage() { Clear(); }
+    LoopStorage (const LoopStorage&) = delete;
+    LoopStorage& operator= (const LoopStorage&) = delete;
+
+    /** Caller owned contiguous memory. clear_mem can be false when mem is known
+        to be zeroed already, e.g. a freshly mapped sparse file.
+    */
+    void Init (float *mem, size_t size, bool clear_mem)
+    {
+        InitPageTable (FLOAT32, size, nullptr);
+        MapContiguous (reinterpret_cast<char*> (mem));
+
+        if (clear_mem)
+            std::fill (mem, mem + size, 0.f);
+    }
+
+    void Init (uint16_t *mem, size_t size, bool clear_mem)
+    {
+        InitPageTable (FLOAT16, size, nullptr);
+        MapContiguous (reinterpret_cast<char*> (mem));
+
+        if (clear_mem)
+            std::fill (mem, mem + size, 0);
+    }
+
+    /** Pool backed memory, nothing is claimed until it's written */
+    void Init (LoopPagePool &pool, StorageFormat format, size_t size)
+    {
+        InitPageTable (format, size, &pool);
+    }
+
+    inline float Read (size_t pos)
+    {
+        if (format_ == FLOAT32)
+            return *PageData<float> (pos);
+
+        // half storage is decoded a block at a time
+        if (! half_reader_.Contains (pos))
+        {
+            const size_t base = sample_format::HalfBlockReader::BlockBase (pos);
+            half_reader_.Fill (PageData<uint16_t> (base),
+                               std::min (sample_format::HalfBlockReader::kBlockSize, size_ - base),
+                               base);
+        }
+        return half_reader_.Get (pos);
+    }
+
+    /** Copies size samples starting at pos into out, a page at a time.
+        The run must not pass the end of the buffer.
+    */
+    void ReadRun (size_t pos, float *out, size_t size)
+    {
+        while (size > 0)
+        {
+            const size_t len = std::min (size, (page_mask_ + 1) - (pos & page_mask_));
+
+            if (format_ == FLOAT32)
+                std::copy (PageData<float> (pos), PageData<float> (pos) + len, out);
+            else
+                sample_format::HalfToFloat (PageData<uint16_t> (pos), out, len);
+
+            pos += len;
+            out += len;
+            size -= len;
+        }
+    }
+
+    inline void Write (size_t pos, float val)
+    {
+        // drop the sample rather than allocate if the pool has run dry
+        if (write_pages_[pos >> page_shift_] == nullptr && ! MakeWritable (pos >> page_shift_))
+            return;
+
+        if (format_ == FLOAT32)
+        {
+            *PageData<float> (pos) = val;
+        }
+        else
+        {
+            const uint16_t h = sample_format::FloatToHalf (val);
+            *PageData<uint16_t> (pos) = h;
+            half_reader_.Update (pos, h);
+        }
+    }
+
+    /** Hands pool pages back, snapshots included, the loop reads as silence afterwards.
+        Lock-free, safe on the audio thread. Does nothing for caller owned memory.
+    */
+    void Clear()
+    {
+        if (pool_ == nullptr)
+            return;
+
+        Unpin();
+        for (size_t s = 0; s < kMaxSnapshots; s++)
+            DropSnapshot (s);
+
+        for (size_t p = 0; p < pages_.size(); p++)
+        {
+            if (page_ids_[p] != LoopPagePool::kNoPage)
+            {
+                pool_->Release (page_ids_[p]);
+                page_ids_[p] = LoopPagePool::kNoPage;
+                pages_[p] = LoopPagePool::ZeroPage();
+                write_pages_[p] = nullptr;
+            }
+        }
+        half_reader_.Reset();
+    }
+
+    /** Snapshots are only kept for pool backed memory */
+    bool CanSnapshot() const { return pool_ != nullptr; }
+
+    /** Stores the page table in slot, replacing whatever was there. Nothing is
+        copied, the pages are shared until they're next written.
+    */
+    void Snapshot (size_t slot)
+    {
+        if (pool_ == nullptr)
+            return;
+
+        DropSnapshot (slot);
+
+        snapshots_[slot] = page_ids_;
+        in_use_[slot] = true;
+
+        std::fill (write_pages_.begin(), write_pages_.end(), nullptr);
+    }
+
+    /** Swaps the page table in slot back in, the slot keeps its copy.
+        Pages nothing else holds go back to the pool.
+    */
+    void Restore (size_t slot)
+    {
+        if (pool_ == nullptr || ! in_use_[slot])
+            return;
+
+        const std::vector<uint32_t> &ids = snapshots_[slot];
+
+        for (size_t p = 0; p < pages_.size(); p++)
+        {
+            if (page_ids_[p] != LoopPagePool::kNoPage && ! IsShared (p, page_ids_[p]))
+                pool_->Release (page_ids_[p]);
+
+            page_ids_[p] = ids[p];
+            pages_[p] = ids[p] != LoopPagePool::kNoPage ? pool_->GetPage (ids[p]) : LoopPagePool::ZeroPage();
+            write_pages_[p] = nullptr;
+        }
+        half_reader_.Reset();
+    }
+
+    /** Forgets slot, pages nothing else holds go back to the pool */
+    void DropSnapshot (size_t slot)
+    {
+        if (! in_use_[slot])
+            return;
+
+        in_use_[slot] = false;
+
+        const std::vector<uint32_t> &ids = snapshots_[slot];
+        for (size_t p = 0; p < ids.size(); p++)
+        {
+            if (ids[p] != LoopPagePool::kNoPage && ids[p] != page_ids_[p] && ! IsShared (p, ids[p]))
+                pool_->Release (ids[p]);
+        }
+    }
+
+    /** Keeps the pages of the current page table as they are until Unpin(), so
+        another thread can read them through PinnedPages(). Writes still work,
+        a pinned page is copied first like a shared one. Pool backed only.
+    */
+    void Pin()
+    {
+        if (pool_ == nullptr)
+            return;
+
+        Unpin();
+        std::copy (page_ids_.begin(), page_ids_.end(), pinned_ids_.begin());
+        pinned_ = true;
+
+        std::fill (write_pages_.begin(), write_pages_.end(), nullptr);
+    }
+
+    /** Releases the pinned pages nothing else holds */
+    void Unpin()
+    {
+        if (! pinned_)
+            return;
+
+        pinned_ = false;
+        for (size_t p = 0; p < pinned_ids_.size(); p++)
+        {
+            const uint32_t id = pinned_ids_[p];
+            if (id != LoopPagePool::kNoPage && id != page_ids_[p] && ! IsShared (p, id))
+                pool_->Release (id);
+        }
+    }
+
+    /** Fills pages with the pinned page table, a page per PageSamples() */
+    void PinnedPages (const char **pages) const
+    {
+        for (size_t p = 0; p < pinned_ids_.size(); p++)
+            pages[p] = pinned_ids_[p] != LoopPagePool::kNoPage ? pool_->GetPage (pinned_ids_[p])
+                                                               : LoopPagePool::ZeroPage();
+    }
+
+    /** Replaces the page table with pages claimed from the pool elsewhere, the
+        first count entries from ids and silence after them. The storage owns
+        them from here on, pages the old table held alone go back to the pool.
+    */
+    void Adopt (const uint32_t *ids, size_t count)
+    {
+        if (pool_ == nullptr)
+            return;
+
+        for (size_t p = 0; p < pages_.size(); p++)
+        {
+            if (page_ids_[p] != LoopPagePool::kNoPage && ! IsShared (p, page_ids_[p]))
+                pool_->Release (page_ids_[p]);
+
+            page_ids_[p] = p < count ? ids[p] : LoopPagePool::kNoPage;
+            pages_[p] = page_ids_[p] != LoopPagePool::kNoPage ? pool_->GetPage (page_ids_[p])
+                                                               : LoopPagePool::ZeroPage();
+            write_pages_[p] = nullptr;
+        }
+        half_reader_.Reset();
+    }
+
+    size_t Size() const { return size_; }
+    StorageFormat GetFormat() const { return format_; }
+
+    static constexpr size_t PageSamples (StorageFormat format) { return LoopPagePool::kPageBytes / BytesPerSample (format); }
+
+private:
+    static constexpr size_t BytesPerSample (StorageFormat format)
+    {
+        return format == FLOAT32 ? sizeof (float) : sizeof (uint16_t);
+    }
+
+    void InitPageTable (StorageFormat format, size_t size, LoopPagePool *pool)
+    {
+        Clear();
+
+        format_ = format;
+        size_ = size;
+        pool_ = pool;
+
+        const size_t page_samples = PageSamples (format);
+        page_shift_ = 0;
+        while ((static_cast<size_t> (1) << page_shift_) < page_samples)
+            page_shift_++;
+        page_mask_ = page_samples - 1;
+
+        const size_t num_pages = (size + page_samples - 1) / page_samples;
+        pages_.assign (num_pages, LoopPagePool::ZeroPage());
+        write_pages_.assign (num_pages, nullptr);
+        page_ids_.assign (num_pages, LoopPagePool::kNoPage);
+
+        for (size_t s = 0; s < kMaxSnapshots; s++)
+            snapshots_[s].assign (pool != nullptr ? num_pages : 0, LoopPagePool::kNoPage);
+        pinned_ids_.assign (pool != nullptr ? num_pages : 0, LoopPagePool::kNoPage);
+
+        half_reader_.Reset();
+    }
+
+    void MapContiguous (char *mem)
+    {
+        for (size_t p = 0; p < pages_.size(); p++)
+            pages_[p] = write_pages_[p] = mem + p * LoopPagePool::kPageBytes;
+    }
+
+    // pages are never moved between page table entries,
+    // so a page can only be shared with a snapshot at the same index
+    bool IsShared (size_t p, uint32_t id) const
+    {
+        if (pinned_ && pinned_ids_[p] == id)
+            return true;
+
+        for (size_t s = 0; s < kMaxSnapshots; s++)
+            if (in_use_[s] && snapshots_[s][p] == id)
+                return true;
+        return false;
+    }
+
+    // first write to an unrecorded page or one shared with a snapshot,
+    // claims a page and copies the old one (or the zero page) into it
+    bool MakeWritable (size_t p)
+    {
+        if (pool_ == nullptr)
+            return false;
+
+        if (page_ids_[p] != LoopPagePool::kNoPage && ! IsShared (p, page_ids_[p]))
+        {
+            write_pages_[p] = pages_[p];
+            return true;
+        }
+
+        const uint32_t id = pool_->Claim();
+        if (id == LoopPagePool::kNoPage)
+            return false;
+
+        // recycled pages still hold whatever loop used them last
+        char *page = pool_->GetPage (id);
+        std::copy (pages_[p], pages_[p] + LoopPagePool::kPageBytes, page);
+
+        page_ids_[p] = id;
+        pages_[p] = page;
+        write_pages_[p] = page;
+        return true;
+    }
+
+    template <typename T>
+    inline T* PageData (size_t pos) const
+    {
+        return reinterpret_cast<T*> (pages_[pos >> page_shift_]) + (pos & page_mask_);
+    }
+
+    StorageFormat format_ = FLOAT32;
+    size_t size_ = 0;
+    size_t page_shift_ = 0;
+    size_t page_mask_ = 0;
+
+    std::vector<char*> pages_;
+    std::vector<char*> write_pages_; // nullptr until the page can be written in place
+    std::vector<uint32_t> page_ids_;
+    LoopPagePool *pool_ = nullptr;
+
+    std::vector<uint32_t> snapshots_[kMaxSnapshots];
+    bool in_use_[kMaxSnapshots] = {};
+
+    std::vector<uint32_t> pinned_ids_;
+    bool pinned_ = false;
+
+    sample_format::HalfBlockReader half_reader_;
+};
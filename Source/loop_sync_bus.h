@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class LoopSyncBus
+{
+public:
+    /**
+           @brief Process wide loop clock shared between looper instances, so
+                  followers can lock their loop length and phase to a master.
+                - One instance at a time claims the master slot and publishes
+                  its loop length and clock at the start of every block
+                - Followers read it once per block, the state is a seqlock of
+                  relaxed atomics so neither side ever waits on the other
+                - Clocks are 32.32 fixed point like the looper's positions, with
+                  a whole cycle count alongside so they never overflow
+    */
+    using Phase = int64_t;
+
+    struct State {
+        Phase length = 0;    // master loop length, 0 if it isn't playing
+        Phase clock = 0;     // master loop clock at the start of its block
+        int64_t cycles = 0;  // times the master loop has come round
+        size_t block = 0;    // samples in the master's block
+        int64_t time_ns = 0; // when the master's block started
+    };
+
+    static LoopSyncBus& Instance()
+    {
+        static LoopSyncBus bus;
+        return bus;
+    }
+
+    /** Takes the master slot if it's free, true if owner holds it */
+    bool ClaimMaster (const void *owner)
+    {
+        const void *expected = nullptr;
+        return master_.compare_exchange_strong (expected, owner) || expected == owner;
+    }
+
+    /** Gives the master slot up if owner holds it, followers see no master */
+    void ReleaseMaster (const void *owner)
+    {
+        if (master_.load (std::memory_order_relaxed) != owner)
+            return;
+
+        Publish (State{});
+        const void *expected = owner;
+        master_.compare_exchange_strong (expected, nullptr);
+    }
+
+    /** Master only, once per block */
+    void Publish (const State &s)
+    {
+        const uint32_t seq = seq_.load (std::memory_order_relaxed);
+        seq_.store (seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        length_.store (s.length, std::memory_order_relaxed);
+        clock_.store (s.clock, std::memory_order_relaxed);
+        cycles_.store (s.cycles, std::memory_order_relaxed);
+        block_.store (s.block, std::memory_order_relaxed);
+        time_ns_.store (s.time_ns, std::memory_order_relaxed);
+
+        seq_.store (seq + 2, std::memory_order_release);
+    }
+
+    /** The master's latest state, false if there's no master playing or
+        it was mid publish every time we looked, try again next block
+    */
+    bool Read (State &s) const
+    {
+        for (int attempt = 0; attempt < 4; attempt++)
+        {
+            const uint32_t before = seq_.load (std::memory_order_acquire);
+            if (before & 1)
+                continue;
+
+            s.length = length_.load (std::memory_order_relaxed);
+            s.clock = clock_.load (std::memory_order_relaxed);
+            s.cycles = cycles_.load (std::memory_order_relaxed);
+            s.block = block_.load (std::memory_order_relaxed);
+            s.time_ns = time_ns_.load (std::memory_order_relaxed);
+
+            std::atomic_thread_fence (std::memory_order_acquire);
+            if (seq_.load (std::memory_order_relaxed) == before)
+                return s.length > 0;
+        }
+        return false;
+    }
+
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds> (
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    LoopSyncBus() {}
+
+    std::atomic<const void*> master_ {nullptr};
+
+    std::atomic<uint32_t> seq_ {0};
+    std::atomic<Phase> length_ {0};
+    std::atomic<Phase> clock_ {0};
+    std::atomic<int64_t> cycles_ {0};
+    std::atomic<size_t> block_ {0};
+    std::atomic<int64_t> time_ns_ {0};
+};
@@ -1,6 +1,23 @@
 #pragma once
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include "dsp.h"
+#include "loop_storage.h"
+#include "slice_index.h"
+#include "seam_finder.h"
+#include "loop_overview.h"
+#include "grain_cloud.h"
+#include "silence_map.h"
+#include "halfband.h"
+#include "loop_bouncer.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 class Looper
 {
@@ -11,317 +28,1579 @@ public:
                 - Select currently looped segment
                 - Select Playback State: reverse, half-time, double-time playback modes
                 - Record in any playback state: reverse, half-time, double time
+                - Store the loop as 32-bit or 16-bit (half) floats
+                - Store the loop in caller owned memory or pages from a shared pool
+                - Play the loop through several read heads at once, each with its
+                  own division, segment, speed and gain
+                - Slice the loop at the transients found while recording
+                - Move the loop points to a seamless join found on a worker thread
+                - Band limit playback above 1x so double speed doesn't alias
+                - Keep a history of takes to undo and redo, sharing the pages
+                  they have in common
+                - Play the current segment as a cloud of grains instead of the heads
+                - Hold state and direction changes for the next zero crossing
+                - Skip the silent parts of the loop, playing zeros instead of reading them
+                - Bounce the main head's segment, warp and all, into a new loop
            @author Solomon Moulang Lewis
            @date Jun 2024
     */
-    Looper(){}
+    Looper() { heads_[0].gain = 1.f; }
     ~Looper(){}
     
-    enum {
-        LISTENING,
-        PLAYING,
-        RECORDING
-    } state_ = LISTENING;
+    enum {
+        LISTENING,
+        PLAYING,
+        RECORDING
+    } state_ = LISTENING;
+    
+    enum TimeManipulation {
+        NORMAL,
+        REVERSE,
+        HALF_SPEED,
+        DOUBLE_SPEED
+    };
+    
+    /** Head 0 is the main head, it also records and is always playing.
+        The others only play, and only while their gain is above 0.
+    */
+    static constexpr size_t kMaxHeads = 4;
+    
+    /** Longest a zero crossing transition waits for its signal to cross zero */
+    static constexpr size_t kMaxTransitionDelay = 2048;
+    
+    /** Most recordings kept for Undo/Redo, the oldest is dropped past this */
+    static constexpr size_t kMaxTakes = LoopStorage::kMaxSnapshots;
+    
+    /** Positions and lengths are 32.32 fixed point sample counts, so the
+        fractional read position keeps the same precision anywhere in the
+        buffer and repeated increments never drift
+    */
+    using Phase = int64_t;
+    static constexpr int kFracBits = 32;
+    static constexpr Phase kOne = static_cast<Phase> (1) << kFracBits;
+    static constexpr Phase kFracMask = kOne - 1;
+    
+    static constexpr Phase ToPhase (size_t samples) { return static_cast<Phase> (samples) << kFracBits; }
+    static constexpr size_t ToIndex (Phase p) { return static_cast<size_t> (p >> kFracBits); }
+    static inline float Frac (Phase p)
+    {
+        return static_cast<float> (static_cast<uint32_t> (p & kFracMask)) * (1.f / static_cast<float> (kOne));
+    }
+    
+    /** clear_mem can be false when mem is known to be zeroed already, e.g. a freshly
+        mapped sparse file, so that Init doesn't fault in every page of the buffer.
+    */
+    void Init (float *mem, size_t size, bool clear_mem = true)
+    {
+        buffer_size_ = ToPhase (size);
+        storage_.Init (mem, size, clear_mem);
+        silence_.Init (size);
+        ResetTakes();
+    }
+    
+    /** Half float storage, halves the loop memory and read bandwidth */
+    void Init (uint16_t *mem, size_t size, bool clear_mem = true)
+    {
+        buffer_size_ = ToPhase (size);
+        storage_.Init (mem, size, clear_mem);
+        silence_.Init (size);
+        ResetTakes();
+    }
+    
+    /** Pool backed storage, memory is only claimed as recording reaches it
+        and handed back when the loop is cleared
+    */
+    void Init (LoopPagePool &pool, LoopStorage::StorageFormat format, size_t size)
+    {
+        buffer_size_ = ToPhase (size);
+        storage_.Init (pool, format, size);
+        silence_.Init (size);
+        ResetTakes();
+    }
+    
+    float Process (const float input)
+    {
+        float sig;
+        ProcessBlock (&input, &sig, 1);
+        return sig;
+    }
+    
+    /** Processes a block, in and out may point to the same buffer.
+        Playback is split into runs that can't reach a segment or buffer wrap,
+        each run is handled by a kernel specialised for its direction,
+        increment and interpolation, picked once per run from a table.
+        Extra heads are mixed in a chunk at a time, so every head reads
+        its part of the loop while the chunk is still in cache.
+        With zero crossing transitions on, a block with a transition pending
+        is rendered a chunk at a time up to the switch point.
+        Parts of a run that only read silent blocks of the loop are zeroed.
+    */
+    void ProcessBlock (const float *in, float *out, size_t size)
+    {
+        played_loud_ = false;
+        
+        if (state_pending_ || manip_pending_ != 0)
+        {
+            ProcessTransitions (in, out, size);
+            played_loud_ = true;
+        }
+        else
+        {
+            Render (in, out, size);
+        }
+        
+        // paced by the samples processed rather than the calls, so a block
+        // split up by the caller doesn't do the catching up many times over
+        if (silence_.IsRescanning())
+        {
+            silence_credit_ += size * kRescanPerSample;
+            silence_.Rescan (storage_, silence_credit_ / SilenceMap::kBlockSize);
+            silence_credit_ %= SilenceMap::kBlockSize;
+        }
+        
+        if (overview_ != nullptr)
+        {
+            if (rescan_left_ > 0)
+                RescanOverview (size * kRescanPerSample);
+            PublishOverview();
+        }
+    }
+    
+    /** True if the last block played nothing but silent parts of the loop,
+        so its output is all zeros and anything after the looper can skip it
+    */
+    bool OutputWasSilent() const { return !played_loud_; }
+    
+    /** Steps LISTENING -> RECORDING -> PLAYING -> LISTENING. With zero crossing
+        transitions on the change waits for the signal it would cut to cross zero,
+        a recording trimmed with SetRecordingLength still stops straight away.
+    */
+    void UpdatePlaybackState()
+    {
+        // toggled again before the last change landed, that one happens now
+        if (state_pending_)
+        {
+            state_pending_ = false;
+            NextPlaybackState();
+        }
+        
+        if (zero_cross_ && !(state_ == RECORDING && length_locked_))
+        {
+            state_pending_ = true;
+            state_wait_ = 0;
+            return;
+        }
+        
+        NextPlaybackState();
+    }
+    
+    
+    /** Steps back to the previous take and plays it. From LISTENING it brings
+        back the take that was playing. Does nothing while recording, or for
+        caller owned memory, which keeps no takes.
+    */
+    void Undo()
+    {
+        if (state_ == RECORDING || num_takes_ == 0)
+            return;
+        
+        if (state_ == LISTENING)
+        {
+            LoadTake (take_pos_);
+            return;
+        }
+        
+        if (take_pos_ > 0)
+        {
+            SaveTake();
+            LoadTake (take_pos_ - 1);
+        }
+    }
+    
+    /** Steps forward to the take that was undone, while playing */
+    void Redo()
+    {
+        if (state_ != PLAYING || take_pos_ + 1 >= num_takes_)
+            return;
+        
+        SaveTake();
+        LoadTake (take_pos_ + 1);
+    }
+    
+    void SetTimeManipulation (float param, size_t head = 0)
+    {
+        TimeManipulation time_manipulation_state;
+        
+        if (param > 0.75f)
+        {
+            time_manipulation_state = DOUBLE_SPEED;
+        }
+        else if (param > 0.5f)
+        {
+            time_manipulation_state = HALF_SPEED;
+        }
+        else if (param > 0.25f)
+        {
+            time_manipulation_state = REVERSE;
+        }
+        else
+        {
+            time_manipulation_state = NORMAL;
+        }
+        
+        SetTimeManipulation (time_manipulation_state, head);
+    }
+    
+    /** With zero crossing transitions on, a playing head that has to turn
+        round keeps going until its signal crosses zero
+    */
+    void SetTimeManipulation (TimeManipulation time_manip, size_t head = 0)
+    {
+        Head &h = heads_[head];
+        const unsigned bit = 1u << head;
+        
+        if (zero_cross_ && state_ == PLAYING && loop_reset_ && !granular_
+            && IsReverse (time_manip) != IsReverse (h.time_manip))
+        {
+            if (!(manip_pending_ & bit) || h.pending_manip != time_manip)
+            {
+                h.pending_manip = time_manip;
+                h.manip_wait = 0;
+                manip_pending_ |= bit;
+            }
+            return;
+        }
+        
+        h.time_manip = time_manip;
+        manip_pending_ &= ~bit;
+    }
+    
+    /** Holds state changes, and direction changes while playing, for the next
+        zero crossing of the signal they'd cut, up to kMaxTransitionDelay samples.
+        Off by default, changes then land at the start of the next block.
+    */
+    void SetZeroCrossingTransitions (bool on)
+    {
+        zero_cross_ = on;
+        
+        if (!on)
+        {
+            if (state_pending_)
+            {
+                state_pending_ = false;
+                NextPlaybackState();
+            }
+            ApplyPendingManips();
+        }
+    }
+    
+    TimeManipulation GetTimeManipulation (size_t head = 0) const { return heads_[head].time_manip; }
+    
+    void SetSegmentDivisions (float loop_length_param, size_t head = 0)
+    {
+        Phase divisions;
+        
+        if (loop_length_param <= 0.125f)
+            divisions = 1;
+        else if (loop_length_param <= 0.25f)
+            divisions = 2; //               /2
+        else if (loop_length_param <= 0.375f)
+            divisions = 4; //               /4
+        else if (loop_length_param <= 0.5f)
+            divisions = 8; //               /8
+        else if (loop_length_param <= 0.625f)
+            divisions = 16; //              /16
+        else if (loop_length_param <= 0.75f)
+            divisions = 32; //              /32
+        else if (loop_length_param <= 0.875f)
+            divisions = 64; //              /64
+        else
+            divisions = 128; //             /128
+        
+        // the segment length is worked out from the recording length when
+        // the bounds are updated, so it follows a recording that's trimmed
+        heads_[head].divisions = divisions;
+    }
+    
+    void SetSelectedSegment (float param, size_t head = 0)
+    {
+        heads_[head].selected_segment = param;
+        heads_[head].selected_segment_index = -1;
+    }
+    
+    /** Selects a segment by index rather than by position in the loop,
+        wrapped to however many segments the current division gives
+    */
+    void SetSelectedSegmentIndex (int index, size_t head = 0)
+    {
+        heads_[head].selected_segment_index = index;
+    }
+    
+    /** How many segments the head's segment selection picks from, the slices
+        in slice mode. A seg-sel value p picks p * GetNumSegments(), clamped.
+    */
+    size_t GetNumSegments (size_t head = 0) const { return static_cast<size_t> (NumSegments (heads_[head])); }
+    
+    /** In slice mode the segment selection picks a slice between the transients
+        found while recording, rather than one of the equal divisions
+    */
+    void SetSliceMode (bool on, size_t head = 0)
+    {
+        heads_[head].slices = on;
+    }
+    
+    /** Keeps overview's peaks up to date as the loop records, and its markers
+        once per block, nullptr for none
+    */
+    void SetOverview (LoopOverview *overview)
+    {
+        overview_ = overview;
+    }
+    
+    /** Low pass filters playback at rates above 1x, on by default */
+    void SetAntiAlias (bool on)
+    {
+        anti_alias_ = on;
+    }
+    
+    /** Plays a cloud of grains from the main head's segment in place of the heads */
+    void SetGranular (bool on)
+    {
+        if (on && !granular_)
+            cloud_.Reset();
+        granular_ = on;
+    }
+    
+    /** position is where grains start along the segment 0 to 1, size and interval
+        (the average time between grains) are in samples, pitch is a rate on top
+        of the main head's time manipulation
+    */
+    void SetGrains (float position, size_t size, float pitch, float interval)
+    {
+        cloud_.SetPosition (position);
+        cloud_.SetGrainSize (size);
+        cloud_.SetInterval (interval);
+        grain_pitch_ = pitch;
+    }
+    
+    /** Level the head is mixed at, extra heads stop playing at 0 */
+    void SetHeadGain (float gain, size_t head)
+    {
+        heads_[head].gain = gain;
+    }
+    
+    /** Length of the recording so far, or of the loop once playing */
+    Phase GetRecordingLength() const { return recsize_; }
+    
+    /** Trims or extends the recording in progress to length, e.g. to a whole
+        number of bars. Call just before the RECORDING -> PLAYING transition.
+    */
+    void SetRecordingLength (Phase length)
+    {
+        if (state_ != RECORDING)
+            return;
+        
+        recsize_ = std::min (std::max (length, kOne), buffer_size_);
+        length_locked_ = true;
+    }
+    
+    /** Searches for a seamless loop point each time playback starts,
+        nullptr to keep the loop points where recording started and stopped.
+        Loops trimmed with SetRecordingLength keep their length and aren't searched.
+    */
+    void SetSeamFinder (SeamFinder *finder)
+    {
+        seam_finder_ = finder;
+    }
+    
+    /** Renders bounces for Bounce(), started with the format and size this looper was Init() with */
+    void SetBouncer (LoopBouncer *bouncer)
+    {
+        bouncer_ = bouncer;
+    }
+    
+    /** Renders the main head's segment the way it's playing, direction and speed
+        included, into a new loop on the bouncer's worker. Once it's done it's
+        swapped in as a new take that plays as a plain forward read, and the main
+        head goes back to the whole loop at normal speed. Only while playing from
+        pool memory, one bounce at a time. Undo brings the loop before it back.
+    */
+    bool Bounce()
+    {
+        if (bouncer_ == nullptr || state_ != PLAYING || !loop_reset_ || !storage_.CanSnapshot()
+            || !bouncer_->IsIdle())
+            return false;
+        
+        Head &main = heads_[0];
+        main.inc = GetIncrementSize (main);
+        UpdateSegmentBounds (main);
+        
+        // one pass over the segment, from the end a reverse head starts at
+        const Phase step = main.inc < 0 ? -main.inc : main.inc;
+        bounce_length_ = std::min (PassLength (main.seg_len, step), buffer_size_);
+        
+        LoopBouncer::Job job;
+        job.seg_start = main.seg_start_pos;
+        job.seg_len = main.seg_len;
+        job.start_offset = main.inc > 0 ? 0 : main.seg_len + main.inc;
+        job.inc = main.inc;
+        job.band_limit = anti_alias_;
+        job.length = ToIndex (bounce_length_ + kFracMask);
+        
+        storage_.Pin();
+        storage_.PinnedPages (bouncer_->SourcePages());
+        bouncer_->Submit (++bounce_id_, job);
+        return true;
+    }
+    
+    /** Counts the bounces that have been swapped in */
+    uint32_t GetBounceCount() const { return bounce_count_; }
+    
+    /** Counts the bounces dropped because the pool had no pages for them */
+    uint32_t GetBounceFailures() const { return bounce_failures_; }
+    
+    /** Time since playback started, wrapped to the loop length, and how many
+        times it's wrapped. It runs at 1x whatever the heads are doing, so it's
+        the clock other loops sync to.
+    */
+    Phase GetLoopClock() const { return loop_clock_; }
+    int64_t GetLoopCycles() const { return loop_cycles_; }
+    
+    /** Moves the loop clock to clock while playing, and every head by the same
+        time at its own speed, keeping to its segment
+    */
+    void SetLoopClock (Phase clock)
+    {
+        if (state_ != PLAYING || !loop_reset_ || recsize_ <= 0)
+            return;
+        
+        // the shorter way round the loop
+        Phase delta = (clock - loop_clock_) % recsize_;
+        if (delta > recsize_ / 2)
+            delta -= recsize_;
+        else if (delta < -recsize_ / 2)
+            delta += recsize_;
+        
+        for (Head &head : heads_)
+        {
+            // the increments are all multiples of half a sample
+            const Phase move = delta * (GetIncrementSize (head) / (kOne / 2)) / 2;
+            
+            Phase offset = (SegmentOffset (head) + move) % head.seg_len;
+            if (offset < 0)
+                offset += head.seg_len;
+            
+            head.pos = head.seg_start_pos + offset;
+            WrapPosToBuffer (head.pos);
+        }
+        
+        loop_clock_ = clock % recsize_;
+        if (loop_clock_ < 0)
+            loop_clock_ += recsize_;
+    }
+    
+    static constexpr size_t kMaxHotSpots = kMaxHeads * 3 + 2;
+    
+    // every head's position and the bounds of its segment, and the span the
+    // grains read when granular, used to keep the buffer pages around them
+    // resident. Heads turned down are included so turning them up doesn't
+    // fault. Returns how many were written to spots
+    size_t GetHotSpots (size_t *spots) const
+    {
+        size_t n = 0;
+        for (const Head &h : heads_)
+        {
+            spots[n++] = ToIndex (h.pos);
+            spots[n++] = ToIndex (h.seg_start_pos);
+            spots[n++] = ToIndex (h.seg_end_pos);
+        }
+        
+        if (granular_)
+        {
+            Phase start, end;
+            cloud_.GetReadSpan (start, end);
+            spots[n++] = ToIndex (start);
+            spots[n++] = ToIndex (end);
+        }
+        
+        return n;
+    }
+    
+private:
+    struct Head {
+        Phase pos = 0;
+        Phase inc = kOne;
+        TimeManipulation time_manip = NORMAL;
+        float gain = 0.f;
+        
+        TimeManipulation pending_manip = NORMAL; // waiting for a zero crossing
+        size_t manip_wait = 0;
+        
+        Phase divisions = 1;
+        bool slices = false;
+        float selected_segment = 0.f;
+        int selected_segment_index = -1;
+        
+        Phase seg_start_pos = 0;
+        Phase seg_end_pos = 0;
+        Phase seg_len = kOne;
+    };
+    
+    static constexpr size_t kMixChunk = 64;
+    static constexpr size_t kRescanPerSample = 16; // 8192 for a 512 sample block
+    static constexpr size_t kTransitionChunk = 64;
+    static constexpr float kNearZero = 1.0e-4f; // -80dB
+    
+    // where a recording sits in the buffer, its pages are kept in the
+    // storage snapshot with the same slot
+    struct Take {
+        Phase recsize = 0;
+        Phase loop_start_pos = 0;
+        Phase loop_end_pos = 0;
+        bool recorded_in_reverse = false;
+        bool length_locked = false;
+        SliceIndex slices;
+    };
+    
+
+    inline const float Read (size_t pos) { return storage_.Read (pos); }
+    float ReadF(Phase pos)
+    {
+        float    a, b, frac;
+        size_t   i_idx = ToIndex (pos);
+        frac           = Frac (pos);
+        a              = Read (i_idx);
+        b              = Read (ToPhase (i_idx + 1) == buffer_size_ ? 0 : i_idx + 1);
+        return a + (b - a) * frac;
+    }
+    // denormals are recorded as 0, they'd only slow down everything reading them
+    inline void Write (size_t pos, float val)
+    {
+        storage_.Write (pos, std::fabs (val) < std::numeric_limits<float>::min() ? 0.f : val);
+    }
+    
+    static Phase GetIncrementSize (const Head &head)
+    {
+        switch (head.time_manip)
+        {
+            case NORMAL:
+                return kOne;
+            case REVERSE:
+                return -kOne;
+            case HALF_SPEED:
+                return kOne / 2;
+            case DOUBLE_SPEED:
+                return 2 * kOne;
+        }
+        return kOne;
+    }
+    
+    void WrapPosToBuffer (Phase &pos) const
+    {
+        if (pos >= buffer_size_)
+            pos -= buffer_size_;
+        else if (pos < 0)
+            pos += buffer_size_;
+    }
+    
+    void AdvanceLoopClock (size_t size)
+    {
+        loop_clock_ += ToPhase (size);
+        while (loop_clock_ >= recsize_ && recsize_ > 0)
+        {
+            loop_clock_ -= recsize_;
+            loop_cycles_++;
+        }
+    }
+    
+    // lowest buffer position of the recording, a reverse recording ends
+    // one step below its last written sample
+    Phase LoopLo() const
+    {
+        return recorded_in_reverse_ ? loop_end_pos_ + kOne : loop_start_pos_;
+    }
+    
+    // segments keep the fractional part of the recording length, so
+    // loops trimmed to a tempo stay in time, but are at least one sample
+    Phase SegmentLength (const Head &head) const
+    {
+        return std::max (recsize_ / head.divisions, kOne);
+    }
+    
+    Phase NumSegments (const Head &head) const
+    {
+        if (head.slices)
+            return static_cast<Phase> (slices_.NumSlices (recsize_));
+        return std::max (recsize_ / SegmentLength (head), static_cast<Phase> (1));
+    }
+    
+    // TODO: fix clicks at loop points
+    void UpdateSegmentBounds (Head &head)
+    {
+        Phase lo = LoopLo();
+        Phase hi = lo + recsize_;
+        Phase start_pos, end_pos, loop_size;
+        bool forward = head.inc > 0;
+        
+        if (head.slices)
+        {
+            // slices are counted in the order they were recorded
+            const size_t num_slices = static_cast<size_t> (NumSegments (head));
+            size_t slice = head.selected_segment_index >= 0
+                         ? static_cast<size_t> (head.selected_segment_index) % num_slices
+                         : static_cast<size_t> (std::max (head.selected_segment, 0.f) * num_slices);
+            if (slice >= num_slices) slice = num_slices - 1;
+            
+            const Phase from = slices_.GetOffset (slice);
+            const Phase to = slice + 1 < num_slices ? slices_.GetOffset (slice + 1) : recsize_;
+            
+            loop_size = std::max (to - from, kOne);
+            start_pos = !recorded_in_reverse_ ? lo + from : hi - to;
+        }
+        else
+        {
+            loop_size = SegmentLength (head);
+            
+            // segments are counted from the start of the loop in the direction of playback
+            Phase num_segments = NumSegments (head);
+            Phase current_segment = head.selected_segment_index >= 0
+                                  ? head.selected_segment_index % num_segments
+                                  : static_cast<Phase>(head.selected_segment * num_segments);
+            if (current_segment >= num_segments) current_segment = num_segments - 1;
+            if (current_segment < 0) current_segment = 0;
+            
+            if (forward)
+                start_pos = lo + (current_segment * loop_size);
+            else
+                start_pos = hi - (current_segment * loop_size) - loop_size;
+        }
+        end_pos = start_pos + loop_size;
+
+        // wrap segment positions to buffer size
+        WrapPosToBuffer (start_pos);
+        WrapPosToBuffer (end_pos);
+        
+        head.seg_start_pos = start_pos;
+        head.seg_end_pos = end_pos;
+        head.seg_len = std::min (loop_size, buffer_size_);
+    }
+    
+    // offset of the head into its segment, modulo the buffer since
+    // segments can straddle its end
+    Phase SegmentOffset (const Head &head) const
+    {
+        Phase offset = head.pos - head.seg_start_pos;
+        if (offset < 0)
+            offset += buffer_size_;
+        return offset;
+    }
+    
+    /** Keeps the head inside [seg_start_pos, seg_start_pos + seg_len).
+        A head stepping off either end carries its overshoot round, so a loop
+        lasts exactly seg_len however long it plays. A head that's outside
+        the segment altogether (the segment changed) jumps to its start.
+    */
+    void WrapPosToSegments (Head &head)
+    {
+        WrapPosToBuffer (head.pos);
+        
+        const Phase offset = SegmentOffset (head);
+        if (offset < head.seg_len)
+            return;
+        
+        if (head.inc > 0)
+        {
+            head.pos = offset < head.seg_len + head.inc ? head.pos - head.seg_len : head.seg_start_pos;
+        }
+        else
+        {
+            head.pos = offset >= buffer_size_ + head.inc ? head.pos + head.seg_len
+                                                         : head.seg_start_pos + head.seg_len + head.inc;
+        }
+        
+        WrapPosToBuffer (head.pos);
+    }
+    
+    /** Number of steps from the head's position that neither WrapPosToSegments
+        nor WrapPosToBuffer would touch, i.e. steps a kernel can take unchecked
+    */
+    size_t SamplesUntilWrap (const Head &head) const
+    {
+        const Phase offset = SegmentOffset (head);
+        if (offset >= head.seg_len)
+            return 0;
+        
+        if (head.inc > 0)
+            return static_cast<size_t> (std::min (head.seg_len - offset - 1,
+                                                  buffer_size_ - head.pos - 1) / head.inc);
+        
+        return static_cast<size_t> (std::min (offset, head.pos) / -head.inc);
+    }
+    
+    // buffer position of the sample offset along the recording, in the order it was recorded
+    Phase RecordedPos (Phase offset) const
+    {
+        Phase pos = !recorded_in_reverse_ ? loop_start_pos_ + offset
+                                          : loop_end_pos_ + recsize_ - offset;
+        WrapPosToBuffer (pos);
+        return pos;
+    }
+    
+    // copies the ends of the recording to the seam finder
+    void RequestSeam()
+    {
+        if (seam_finder_ == nullptr || length_locked_)
+            return;
+        
+        // drop anything left from an earlier loop
+        size_t start, end;
+        seam_finder_->GetResult (seam_id_, start, end);
+        
+        const size_t rec_len = ToIndex (recsize_);
+        if (!seam_finder_->IsIdle() || rec_len < SeamFinder::kStartLen + SeamFinder::kEndLen)
+            return;
+        
+        float *start_window = seam_finder_->StartWindow();
+        for (size_t i = 0; i < SeamFinder::kStartLen; i++)
+            start_window[i] = Read (ToIndex (RecordedPos (ToPhase (i))));
+        
+        float *end_window = seam_finder_->EndWindow();
+        const size_t end_base = rec_len - SeamFinder::kEndLen;
+        for (size_t i = 0; i < SeamFinder::kEndLen; i++)
+            end_window[i] = Read (ToIndex (RecordedPos (ToPhase (end_base + i))));
+        
+        seam_finder_->Submit (++seam_id_);
+    }
+    
+    // moves the loop points to the seam found, if the search has finished
+    void CollectSeam()
+    {
+        size_t start, end;
+        if (seam_finder_ == nullptr || !seam_finder_->GetResult (seam_id_, start, end))
+            return;
+        
+        const Phase from = ToPhase (start);
+        const Phase to = ToPhase (ToIndex (recsize_) - SeamFinder::kEndLen + end);
+        
+        if (!recorded_in_reverse_)
+        {
+            loop_start_pos_ += from;
+            recsize_ = to - from;
+            loop_end_pos_ = loop_start_pos_ + recsize_;
+        }
+        else
+        {
+            loop_end_pos_ += recsize_ - to;
+            recsize_ = to - from;
+            loop_start_pos_ = loop_end_pos_ + recsize_ - kOne;
+        }
+        
+        WrapPosToBuffer (loop_start_pos_);
+        WrapPosToBuffer (loop_end_pos_);
+        slices_.Trim (from);
+    }
     
-    enum {
-        NORMAL,
-        REVERSE,
-        HALF_SPEED,
-        DOUBLE_SPEED
-    } time_manipulation_state_ = NORMAL;
+    void ResetTakes()
+    {
+        num_takes_ = 0;
+        take_pos_ = 0;
+        oldest_take_ = 0;
+        rescan_left_ = 0;
+    }
+    
+    size_t TakeSlot (size_t take) const { return (oldest_take_ + take) % kMaxTakes; }
+    
+    // adds the recording that just finished after the current take,
+    // anything that was undone is dropped and so is the oldest take when full
+    void PushTake()
+    {
+        if (!storage_.CanSnapshot())
+            return;
+        
+        while (num_takes_ > take_pos_ + 1)
+            storage_.DropSnapshot (TakeSlot (--num_takes_));
+        
+        if (num_takes_ == kMaxTakes)
+        {
+            storage_.DropSnapshot (TakeSlot (0));
+            oldest_take_ = TakeSlot (1);
+            num_takes_--;
+        }
+        
+        take_pos_ = num_takes_++;
+        storage_.Snapshot (TakeSlot (take_pos_));
+        SaveTake();
+    }
     
-    void Init (float *mem, size_t size)
+    // the loop points can still move after the take is pushed, e.g. to a seam
+    void SaveTake()
     {
-        buff_ = mem;
-        buffer_size_ = size;
+        if (num_takes_ == 0)
+            return;
         
-        InitBuff();
+        Take &take = takes_[TakeSlot (take_pos_)];
+        take.recsize = recsize_;
+        take.loop_start_pos = loop_start_pos_;
+        take.loop_end_pos = loop_end_pos_;
+        take.recorded_in_reverse = recorded_in_reverse_;
+        take.length_locked = length_locked_;
+        take.slices = slices_;
     }
     
-    float Process (const float input)
+    // swaps the take's page table in and plays it from the top
+    void LoadTake (size_t take_pos)
+    {
+        take_pos_ = take_pos;
+        storage_.Restore (TakeSlot (take_pos_));
+        
+        const Take &take = takes_[TakeSlot (take_pos_)];
+        recsize_ = take.recsize;
+        loop_start_pos_ = take.loop_start_pos;
+        loop_end_pos_ = take.loop_end_pos;
+        recorded_in_reverse_ = take.recorded_in_reverse;
+        length_locked_ = take.length_locked;
+        slices_ = take.slices;
+        
+        for (Head &head : heads_)
+            head.pos = loop_start_pos_;
+        
+        state_ = PLAYING;
+        loop_reset_ = true; // the loop points are already known
+        loop_clock_ = 0;
+        loop_cycles_ = 0;
+        seam_id_++; // a seam search still running was for the take being left
+        bounce_id_++; // and so was a bounce
+        StartRescans();
+    }
+    
+    // the storage holds a different loop, the silence map and the overview
+    // catch up with it over the next few blocks
+    void StartRescans()
+    {
+        silence_.StartRescan();
+        
+        if (overview_ != nullptr)
+        {
+            overview_->BeginRecording();
+            rescan_pos_ = ToIndex (LoopLo());
+            rescan_left_ = std::min (ToIndex (recsize_) + 1, ToIndex (buffer_size_));
+        }
+    }
+    
+    // length of one pass over len at step, in output samples
+    static Phase PassLength (Phase len, Phase step)
+    {
+        if ((step & kFracMask) == 0)
+            return len / static_cast<Phase> (ToIndex (step));
+        return static_cast<Phase> (static_cast<double> (len) * (static_cast<double> (kOne) / static_cast<double> (step)));
+    }
+    
+    // swaps a finished bounce in as a new take, or drops it if the loop has
+    // moved on since it was asked for
+    void CollectBounce()
+    {
+        if (bouncer_ == nullptr || !bouncer_->IsDone())
+            return;
+        
+        const uint32_t *pages = nullptr;
+        size_t num_pages = 0;
+        
+        if (state_ != PLAYING)
+        {
+            bouncer_->Discard();
+        }
+        else if (bouncer_->Failed (bounce_id_))
+        {
+            bouncer_->Discard();
+            bounce_failures_++; // the pool ran dry, the loop carries on as it was
+        }
+        else if (bouncer_->TakeResult (bounce_id_, pages, num_pages))
+        {
+            SaveTake(); // the take being left keeps any seam it moved to
+            storage_.Adopt (pages, num_pages);
+            
+            recsize_ = bounce_length_;
+            loop_start_pos_ = 0;
+            loop_end_pos_ = recsize_;
+            WrapPosToBuffer (loop_end_pos_);
+            recorded_in_reverse_ = false;
+            length_locked_ = true; // nothing to look for a seam in
+            slices_.Reset();
+            
+            // the warp is in the loop now
+            Head &main = heads_[0];
+            main.time_manip = NORMAL;
+            main.divisions = 1;
+            main.selected_segment = 0.f;
+            main.selected_segment_index = -1;
+            manip_pending_ &= ~1u;
+            
+            for (Head &head : heads_)
+                head.pos = 0;
+            
+            loop_clock_ = 0;
+            loop_cycles_ = 0;
+            seam_id_++;
+            bounce_count_++;
+            
+            PushTake();
+            StartRescans();
+        }
+        
+        storage_.Unpin();
+    }
+    
+    // redraws the peaks of a restored take max_samples at a time,
+    // so undo never stalls the audio thread reading the whole loop
+    void RescanOverview (size_t max_samples)
+    {
+        const size_t size = ToIndex (buffer_size_);
+        size_t budget = std::min (rescan_left_, max_samples);
+        rescan_left_ -= budget;
+        
+        float chunk[kMixChunk];
+        while (budget > 0)
+        {
+            const size_t len = std::min (std::min (budget, kMixChunk), size - rescan_pos_);
+            storage_.ReadRun (rescan_pos_, chunk, len);
+            
+            for (size_t i = 0; i < len; i++)
+                overview_->Write (rescan_pos_ + i, chunk[i]);
+            
+            rescan_pos_ += len;
+            if (rescan_pos_ == size)
+                rescan_pos_ = 0;
+            budget -= len;
+        }
+        
+        overview_->Flush();
+    }
+    
+    void PublishOverview()
+    {
+        static_assert (kMaxHeads <= LoopOverview::kMaxHeads, "overview can't show every head");
+        
+        const Head &main = heads_[0];
+        LoopOverview::Markers m;
+        
+        Phase lo;
+        if (state_ == RECORDING)
+        {
+            overview_->Flush();
+            lo = !recorded_in_reverse_ ? main.pos - recsize_ : main.pos + kOne;
+        }
+        else
+        {
+            lo = LoopLo();
+        }
+        WrapPosToBuffer (lo);
+        
+        m.state = state_;
+        m.loop_start = ToIndex (lo);
+        m.loop_length = ToIndex (recsize_);
+        m.seg_start = ToIndex (main.seg_start_pos);
+        m.seg_length = ToIndex (main.seg_len);
+        m.slices = main.slices;
+        m.failed_bounces = bounce_failures_;
+        
+        for (size_t h = 0; h < kMaxHeads; h++)
+        {
+            m.head_pos[h] = ToIndex (heads_[h].pos);
+            m.head_active[h] = state_ == PLAYING && heads_[h].gain > 0.f;
+        }
+        
+        overview_->SetMarkers (m);
+    }
+    
+    // the block as it's processed with no transition pending
+    void Render (const float *in, float *out, size_t size)
     {
-        float sig = 0.f;
-        float inc = GetIncrementSize();
+        Head &main = heads_[0];
+        
+        CollectBounce();
         
         switch (state_)
         {
             case LISTENING:
-                sig = input;
+                if (out != in)
+                    std::copy (in, in + size, out);
+                played_loud_ = true;
                 break;
             //====================================================
             case RECORDING:
-                //
-                sig = input; // when recording only listen to input
-                Write( pos_, input);
-                
-                // reset recsize_ and set recsize_reset_ flag
-                if (!recsize_reset_)
-                {
-                    recsize_ = 0;
-                    recsize_reset_ = true;
-                }
-                
-                pos_ += inc;
-                recsize_ += fabsf (inc);
-                
-                WrapPosToBuffer();
+            {
+                const Phase inc = GetIncrementSize (main);
+                played_loud_ = true;
                 
-                // ensure max recsize_ == buffer_size_
-                if (recsize_ >= buffer_size_)
+                for (size_t i = 0; i < size; i++)
                 {
-                    recsize_ = buffer_size_;
+                    const float input = in[i];
+                    const size_t index = ToIndex (main.pos);
+                    out[i] = input; // when recording only listen to input
+                    silence_.Touch (storage_, index);
+                    Write (index, input);
+                    
+                    // reset recsize_ and set recsize_reset_ flag
+                    if (!recsize_reset_)
+                    {
+                        recsize_ = 0;
+                        recsize_reset_ = true;
+                        slices_.Reset();
+                        length_locked_ = false;
+                        rescan_left_ = 0;
+                        
+                        if (overview_ != nullptr)
+                            overview_->BeginRecording();
+                    }
+                    
+                    slices_.Analyse (input, recsize_);
+                    
+                    if (overview_ != nullptr)
+                        overview_->Write (index, input);
+                    
+                    main.pos += inc;
+                    recsize_ += inc < 0 ? -inc : inc;
+                    recorded_in_reverse_ = inc < 0;
+                    
+                    WrapPosToBuffer (main.pos);
+                    
+                    // ensure max recsize_ == buffer_size_
+                    if (recsize_ >= buffer_size_)
+                    {
+                        recsize_ = buffer_size_;
+                    }
                 }
                 
-                loop_size_ = recsize_;
-                
+                silence_.Flush (storage_);
                 loop_reset_ = false;
                 break;
+            }
             //====================================================
             case PLAYING:
                 //
                 if (!loop_reset_)
                 {
-                    // calculate loop_start_pos_ position in buffer
-                    if (inc > 0)
-                        loop_start_pos_ = pos_ - recsize_; // forward record
+                    // calculate loop_start_pos_ position in buffer,
+                    // the first sample of the recording
+                    if (!recorded_in_reverse_)
+                        loop_start_pos_ = main.pos - recsize_; // forward record
                     else
-                        loop_start_pos_ = pos_ + recsize_ - 1; // reverse record
-                    
-                    recorded_in_reverse_ = inc < 0 ? true : false;
+                        loop_start_pos_ = main.pos + recsize_ - kOne; // reverse record
                     
                     // wrap loop_start_pos_ to buffer
-                    if (loop_start_pos_ >= buffer_size_)
-                        loop_start_pos_ -= buffer_size_;
-                    else if (loop_start_pos_ < 0)
-                        loop_start_pos_ += buffer_size_;
+                    WrapPosToBuffer (loop_start_pos_);
                     
-                    loop_end_pos_ = pos_;
+                    loop_end_pos_ = main.pos;
                     
-                    // update pos
-                    pos_ = loop_start_pos_;
+                    // every head starts from the top of the loop
+                    for (Head &head : heads_)
+                        head.pos = loop_start_pos_;
                     
                     loop_reset_ = true;
+                    
+                    loop_clock_ = 0;
+                    loop_cycles_ = 0;
+                    
+                    PushTake();
+                    RequestSeam();
                 }
                 
-                sig = ReadF (pos_); // read with interpolation
-                pos_ += inc;
+                CollectSeam();
                 
-                WrapPosToSegments (inc);
+                // segment bounds only change with the block rate parameters
+                for (Head &head : heads_)
+                {
+                    head.inc = GetIncrementSize (head);
+                    UpdateSegmentBounds (head);
+                }
+                
+                if (granular_)
+                {
+                    // grains follow the main head's segment, direction and speed
+                    cloud_.SetRegion (main.seg_start_pos, main.seg_len);
+                    cloud_.SetRate (grain_pitch_ * static_cast<float> (main.inc) / static_cast<float> (kOne));
+                    cloud_.Process (storage_, silence_, out, size);
+                    played_loud_ = true;
+                }
+                else if (NumPlayingHeads() == 1 && main.gain == 1.f)
+                {
+                    PlayHead (main, out, size);
+                }
+                else
+                {
+                    for (size_t i = 0; i < size; i += kMixChunk)
+                    {
+                        const size_t len = std::min (kMixChunk, size - i);
+                        MixHeads (out + i, len);
+                    }
+                }
                 
-                WrapPosToBuffer();
+                AdvanceLoopClock (size);
                 
                 // reset flag for ensuring new recording size when entering playback state
                 recsize_reset_ = false;
                 break;
         }
-        return sig;
     }
     
-    void UpdatePlaybackState()
+    void NextPlaybackState()
     {
         switch (state_)
         {
             case LISTENING:
                 state_ = RECORDING;
-                std::cout << "state RECORDING" << std::endl;
                 break;
             case RECORDING:
                 state_ = PLAYING;
-                std::cout << "state PLAYING" << std::endl;
                 break;
             case PLAYING:
                 state_ = LISTENING;
-                std::cout << "state LISTENING" << std::endl;
+                SaveTake(); // the loop stays in the history, Undo brings it back
+                seam_id_++; // a seam search still running for it is dropped
+                bounce_id_++; // and so is a bounce
+                ApplyPendingManips(); // nothing to turn round any more
                 break;
         };
     }
     
-    void SetTimeManipulation (float param)
+    // renders the block a chunk at a time, stopping at the switch point of
+    // each pending transition: the first sample of the signal it would cut
+    // that's crossed zero (or is near enough), or where its wait runs out
+    void ProcessTransitions (const float *in, float *out, size_t size)
     {
-        if (param > 0.75f)
-        {
-            time_manipulation_state_ = DOUBLE_SPEED;
-        }
-        else if (param > 0.5f)
-        {
-            time_manipulation_state_ = HALF_SPEED;
-        }
-        else if (param > 0.25f)
-        {
-            time_manipulation_state_ = REVERSE;
-        }
-        else
+        size_t done = 0;
+        
+        while (done < size && (state_pending_ || manip_pending_ != 0))
         {
-            time_manipulation_state_ = NORMAL;
+            const size_t n = std::min (kTransitionChunk, size - done);
+            
+            if (state_pending_ && state_ == PLAYING)
+            {
+                // the loop is what's cut, play the chunk and hand what's
+                // past the switch point over to the input
+                Render (in + done, out + done, n);
+                
+                const size_t k = SwitchPoint (out + done, n, state_wait_);
+                if (k < n)
+                {
+                    state_pending_ = false;
+                    NextPlaybackState();
+                    std::copy (in + done + k, in + done + n, out + done + k);
+                }
+                
+                state_wait_ += n;
+                done += n;
+                continue;
+            }
+            
+            // recording starts and stops on the input
+            size_t k = n;
+            size_t state_k = n;
+            if (state_pending_)
+                k = state_k = SwitchPoint (in + done, n, state_wait_);
+            
+            // a head turns round where its own signal crosses zero,
+            // played ahead on a copy so nothing moves
+            size_t head_k[kMaxHeads];
+            for (size_t h = 0; h < kMaxHeads; h++)
+            {
+                head_k[h] = n;
+                if (!(manip_pending_ & (1u << h)))
+                    continue;
+                
+                float probe_out[kTransitionChunk];
+                Head probe = heads_[h];
+                probe.inc = GetIncrementSize (probe);
+                UpdateSegmentBounds (probe);
+                PlayHead (probe, probe_out, n);
+                
+                head_k[h] = SwitchPoint (probe_out, n, heads_[h].manip_wait);
+                k = std::min (k, head_k[h]);
+            }
+            
+            if (k > 0)
+                Render (in + done, out + done, k);
+            done += k;
+            
+            if (state_k == k && k < n)
+            {
+                state_pending_ = false;
+                NextPlaybackState();
+            }
+            state_wait_ += k;
+            
+            for (size_t h = 0; h < kMaxHeads; h++)
+            {
+                if (!(manip_pending_ & (1u << h)))
+                    continue;
+                
+                if (head_k[h] == k && k < n)
+                {
+                    heads_[h].time_manip = heads_[h].pending_manip;
+                    manip_pending_ &= ~(1u << h);
+                }
+                heads_[h].manip_wait += k;
+            }
         }
+        
+        if (done < size)
+            Render (in + done, out + done, size - done);
     }
     
-    void SetSegmentDivisions (float loop_length_param)
+    // switch point in the n samples of x, n if it's not in them
+    static size_t SwitchPoint (const float *x, size_t n, size_t wait)
     {
-        if (loop_length_param <= 0.125f)
-            loop_size_ = recsize_;
-        else if (loop_length_param <= 0.25f)
-            loop_size_ = recsize_ / 2; //               /2
-        else if (loop_length_param <= 0.375f)
-            loop_size_ = recsize_ / 4; //               /4
-        else if (loop_length_param <= 0.5f)
-            loop_size_ = recsize_ / 8; //               /8
-        else if (loop_length_param <= 0.625f)
-            loop_size_ = recsize_ / 16; //              /16
-        else if (loop_length_param <= 0.75f)
-            loop_size_ = recsize_ / 32; //              /32
-        else if (loop_length_param <= 0.875f)
-            loop_size_ = recsize_ / 64; //              /64
-        else
-            loop_size_ = recsize_ / 128; //             /128
+        return std::min (FindZeroCrossing (x, n), kMaxTransitionDelay - std::min (wait, kMaxTransitionDelay));
     }
     
-    void SetSelectedSegment (float param)
+    /** First sample of x on the other side of zero from the one before it, or
+        within kNearZero of it, n if there's none. Four samples at a time.
+    */
+    static size_t FindZeroCrossing (const float *x, size_t n)
     {
-        selected_segment_ = param;
+        if (n == 0 || std::fabs (x[0]) < kNearZero)
+            return 0;
+        
+        size_t i = 1;
+#if defined(__SSE__) || defined(_M_X64)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 near_zero = _mm_set1_ps (kNearZero);
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128 a = _mm_loadu_ps (x + i);
+            const __m128 b = _mm_loadu_ps (x + i - 1);
+            const __m128 flip = _mm_xor_ps (_mm_cmplt_ps (a, zero), _mm_cmplt_ps (b, zero));
+            const __m128 quiet = _mm_cmplt_ps (_mm_max_ps (a, _mm_sub_ps (zero, a)), near_zero);
+            
+            const int mask = _mm_movemask_ps (_mm_or_ps (flip, quiet));
+            if (mask != 0)
+                for (size_t lane = 0; lane < 4; lane++)
+                    if (mask & (1 << lane))
+                        return i + lane;
+        }
+#elif defined(__ARM_NEON)
+        const float32x4_t zero = vdupq_n_f32 (0.f);
+        const float32x4_t near_zero = vdupq_n_f32 (kNearZero);
+        for (; i + 4 <= n; i += 4)
+        {
+            const float32x4_t a = vld1q_f32 (x + i);
+            const float32x4_t b = vld1q_f32 (x + i - 1);
+            const uint32x4_t flip = veorq_u32 (vcltq_f32 (a, zero), vcltq_f32 (b, zero));
+            const uint32x4_t hit = vorrq_u32 (flip, vcaltq_f32 (a, near_zero));
+            
+            const uint32x2_t half = vorr_u32 (vget_low_u32 (hit), vget_high_u32 (hit));
+            if (vget_lane_u32 (vpmax_u32 (half, half), 0) != 0)
+                break; // the scalar loop finds which one
+        }
+#endif
+        for (; i < n; i++)
+            if ((x[i] < 0.f) != (x[i - 1] < 0.f) || std::fabs (x[i]) < kNearZero)
+                return i;
+        
+        return n;
     }
     
-private:
-    void InitBuff() { std::fill (&buff_[0], &buff_[buffer_size_ - 1], 0); }
-    
-    inline const float Read (size_t pos) const { return buff_[pos]; }
-    float ReadF(float pos)
+    // direction changes still waiting take effect straight away
+    void ApplyPendingManips()
     {
-        float    a, b, frac;
-        uint32_t i_idx = static_cast<uint32_t>(pos);
-        frac           = pos - i_idx;
-        a              = buff_[i_idx];
-        b              = buff_[(i_idx + 1) % buffer_size_];
-        return a + (b - a) * frac;
+        for (size_t h = 0; h < kMaxHeads; h++)
+            if (manip_pending_ & (1u << h))
+                heads_[h].time_manip = heads_[h].pending_manip;
+        manip_pending_ = 0;
     }
-    inline void Write (size_t pos, float val) { buff_[pos] = val; }
     
-    float GetIncrementSize()
-    {
-        switch (time_manipulation_state_)
-        {
-            case NORMAL:
-                return 1.0f;
-            case REVERSE:
-                return -1.0f;
-            case HALF_SPEED:
-                return 0.5f;
-            case DOUBLE_SPEED:
-                return 2.0f;
-        }
-        return 1.0f;
-    }
+    static bool IsReverse (TimeManipulation time_manip) { return time_manip == REVERSE; }
     
-    void WrapPosToBuffer()
+    size_t NumPlayingHeads() const
     {
-        if (pos_ >= buffer_size_)
-            pos_ -= buffer_size_;
-        else if (pos_ < 0)
-            pos_ += buffer_size_;
+        size_t n = 1;
+        for (size_t h = 1; h < kMaxHeads; h++)
+            n += heads_[h].gain > 0.f ? 1 : 0;
+        return n;
     }
     
-    // TODO: fix clicks at loop points
-    void WrapPosToSegments (float &inc)
-    {
-        // if recorded in reverse then loop from end -> start
-        // else start -> end
-        float start_pos = recorded_in_reverse_ ? loop_end_pos_ : loop_start_pos_;
-        float end_pos = recorded_in_reverse_ ? loop_start_pos_ : loop_end_pos_;
-        bool forward = inc > 0;
-        
-        int num_segments = static_cast<int> (recsize_ / loop_size_);
-        int current_segment = static_cast<int>(selected_segment_ * num_segments);
-        if (current_segment >= num_segments) current_segment = num_segments - 1;
-        if (current_segment < 0) current_segment = 0;
-
-        if (recorded_in_reverse_)
+    /** Plays size samples of one head into out */
+    void PlayHead (Head &head, float *out, size_t size)
+    {
+        for (size_t i = 0; i < size;)
         {
-            if (forward)
-            {
-                start_pos += (current_segment * loop_size_);
-                end_pos = start_pos + loop_size_;
-            }
-            else
+            const size_t run = std::min (SamplesUntilWrap (head), size - i);
+            
+            if (run == 0)
             {
-                end_pos -= (current_segment * loop_size_);
-                start_pos = end_pos - loop_size_;
+                // the next step wraps, take it one sample at a time
+                out[i++] = ReadF (head.pos); // read with interpolation
+                head.pos += head.inc;
+                played_loud_ = true;
+                
+                WrapPosToSegments (head);
+                continue;
             }
+            
+            PlayRunSkippingSilence (head, out + i, run);
+            i += run;
         }
-        else
+    }
+    
+    /** Plays a run a kMixChunk at a time, chunks that only read silent blocks
+        are zeroed and the rest are handed to the run's kernel together
+    */
+    void PlayRunSkippingSilence (Head &head, float *out, size_t size)
+    {
+        size_t from = 0; // head.pos is at out[from]
+        
+        for (size_t i = 0; i < size; i += kMixChunk)
         {
-            if (forward)
-            {
-                start_pos += (current_segment * loop_size_);
-                end_pos = start_pos + loop_size_;
-            }
-            else
+            const size_t n = std::min (kMixChunk, size - i);
+            const Phase first = head.pos + head.inc * static_cast<Phase> (i - from);
+            const Phase last = first + head.inc * static_cast<Phase> (n - 1);
+            
+            // everything a kernel could read, the half band filter reaches furthest
+            constexpr int64_t reach = kHalfbandHalfTaps + 1;
+            const int64_t lo = static_cast<int64_t> (ToIndex (std::min (first, last))) - reach;
+            const int64_t hi = static_cast<int64_t> (ToIndex (std::max (first, last))) + reach;
+            
+            if (!silence_.IsSilent (lo, hi))
+                continue;
+            
+            if (i > from)
             {
-                end_pos -= (current_segment * loop_size_);
-                start_pos = end_pos - loop_size_;
+                (this->*SelectPlayKernel (head)) (head, out + from, i - from);
+                played_loud_ = true;
             }
+            
+            std::fill (out + i, out + i + n, 0.f);
+            head.pos += head.inc * static_cast<Phase> (n);
+            from = i + n;
         }
-
-        // wrap segment positions to buffer size
-        if (start_pos < 0)
+        
+        if (size > from)
         {
-            start_pos += buffer_size_;
+            (this->*SelectPlayKernel (head)) (head, out + from, size - from);
+            played_loud_ = true;
         }
-        else if (start_pos >= buffer_size_)
+    }
+    
+    /** Plays every head over one chunk of at most kMixChunk samples,
+        summed into out at their gains
+    */
+    void MixHeads (float *out, size_t size)
+    {
+        float chunk[kMixChunk];
+        
+        PlayHead (heads_[0], out, size);
+        
+        if (heads_[0].gain != 1.f)
+            for (size_t i = 0; i < size; i++)
+                out[i] *= heads_[0].gain;
+        
+        for (size_t h = 1; h < kMaxHeads; h++)
         {
-            start_pos -= buffer_size_;
+            Head &head = heads_[h];
+            if (head.gain <= 0.f)
+                continue;
+            
+            PlayHead (head, chunk, size);
+            
+            for (size_t i = 0; i < size; i++)
+                out[i] += chunk[i] * head.gain;
         }
-
-        if (end_pos < 0)
+    }
+    
+    //====================================================
+    // playback kernels
+    
+    enum IncrementClass {
+        UNIT,           // +-1, whole samples
+        FRACTIONAL,     // |inc| < 1
+        INTEGER_SKIP    // whole samples > 1
+    };
+    
+    using PlayKernel = void (Looper::*) (Head&, float*, size_t);
+    
+    PlayKernel SelectPlayKernel (const Head &head) const
+    {
+        static constexpr PlayKernel kPlayKernels[2][3][2] = {
+            {
+                { &Looper::PlayRun<true, UNIT, false>, &Looper::PlayRun<true, UNIT, true> },
+                { &Looper::PlayRun<true, FRACTIONAL, false>, &Looper::PlayRun<true, FRACTIONAL, true> },
+                { &Looper::PlayRun<true, INTEGER_SKIP, false>, &Looper::PlayRun<true, INTEGER_SKIP, true> }
+            },
+            {
+                { &Looper::PlayRun<false, UNIT, false>, &Looper::PlayRun<false, UNIT, true> },
+                { &Looper::PlayRun<false, FRACTIONAL, false>, &Looper::PlayRun<false, FRACTIONAL, true> },
+                { &Looper::PlayRun<false, INTEGER_SKIP, false>, &Looper::PlayRun<false, INTEGER_SKIP, true> }
+            }
+        };
+        
+        static constexpr PlayKernel kDecimateKernels[2][2] = {
+            { &Looper::PlayDecimated<true, false>, &Looper::PlayDecimated<true, true> },
+            { &Looper::PlayDecimated<false, false>, &Looper::PlayDecimated<false, true> }
+        };
+        
+        const Phase step = head.inc < 0 ? -head.inc : head.inc;
+        const bool whole_step = (step & kFracMask) == 0;
+        const int inc_class = step == kOne ? UNIT : (whole_step ? INTEGER_SKIP : FRACTIONAL);
+        
+        // whole steps from a whole position never land between samples
+        const bool interpolate = !whole_step || (head.pos & kFracMask) != 0;
+        
+        if (anti_alias_ && inc_class == INTEGER_SKIP)
+            return kDecimateKernels[head.inc > 0 ? 0 : 1][interpolate ? 1 : 0];
+        
+        return kPlayKernels[head.inc > 0 ? 0 : 1][inc_class][interpolate ? 1 : 0];
+    }
+    
+    template <bool Forward, IncrementClass Inc, bool Interpolate>
+    void PlayRun (Head &head, float *out, size_t size)
+    {
+        if constexpr (Forward && Inc == UNIT && !Interpolate)
         {
-            end_pos += buffer_size_;
+            // straight copy out of the storage
+            storage_.ReadRun (ToIndex (head.pos), out, size);
+            head.pos += ToPhase (size);
+            return;
         }
-        else if (end_pos >= buffer_size_)
+        
+        const Phase step = Inc == UNIT ? (Forward ? kOne : -kOne) : head.inc;
+        Phase pos = head.pos;
+        
+        for (size_t i = 0; i < size; i++)
         {
-            end_pos -= buffer_size_;
+            if constexpr (Interpolate)
+                out[i] = ReadF (pos);
+            else
+                out[i] = Read (ToIndex (pos));
+            
+            pos += step;
         }
-
-        // wrap pos to start/end pos
-        if (start_pos < end_pos)
+        
+        head.pos = pos;
+    }
+    
+    //====================================================
+    // band limited playback, skipping whole samples
+    
+    static constexpr int kHalfbandHalfTaps = Halfband::kHalfTaps;
+    
+    static constexpr size_t kDecimateChunk = 64;
+    
+    /** Same as PlayRun for whole sample skips, but reads through the half band
+        filter. Each chunk of source samples is copied out of the storage once,
+        with the filter's reach either side, and filtered from there.
+    */
+    template <bool Forward, bool Interpolate>
+    void PlayDecimated (Head &head, float *out, size_t size)
+    {
+        constexpr size_t reach = kHalfbandHalfTaps + 1;
+        float src[kDecimateChunk * 2 + 2 * reach + 1];
+        
+        const Phase step = head.inc;
+        const size_t skip = ToIndex (Forward ? step : -step);
+        const size_t max_chunk = std::max ((kDecimateChunk * 2) / skip, static_cast<size_t> (1));
+        const int64_t buffer_len = static_cast<int64_t> (ToIndex (buffer_size_));
+        
+        Phase pos = head.pos;
+        
+        for (size_t i = 0; i < size;)
         {
-            if ((forward && (pos_ < start_pos || pos_ > end_pos)) ||
-                (!forward && (pos_ > end_pos || pos_ < start_pos)))
+            const size_t n = std::min (max_chunk, size - i);
+            const int64_t first = static_cast<int64_t> (ToIndex (pos));
+            const int64_t last = static_cast<int64_t> (ToIndex (pos + static_cast<Phase> (n - 1) * step));
+            const int64_t lo = std::min (first, last) - kHalfbandHalfTaps;
+            const int64_t hi = std::max (first, last) + kHalfbandHalfTaps + (Interpolate ? 1 : 0);
+            const size_t len = static_cast<size_t> (hi - lo + 1);
+            
+            if (lo >= 0 && hi < buffer_len)
             {
-                // entered if recorded in normal
-
-                pos_ = forward ? start_pos : end_pos;
+                storage_.ReadRun (static_cast<size_t> (lo), src, len);
             }
-        }
-        else
-        {
-            if ((forward && (pos_ < start_pos && pos_ > end_pos)) ||
-                (!forward && (pos_ > end_pos && pos_ < start_pos)))
+            else
             {
-                // entered if recorded in reverse
-
-                pos_ = forward ? start_pos : end_pos;
+                // the filter reaches round the end of the buffer
+                for (size_t j = 0; j < len; j++)
+                {
+                    int64_t idx = lo + static_cast<int64_t> (j);
+                    idx = idx < 0 ? idx + buffer_len : (idx >= buffer_len ? idx - buffer_len : idx);
+                    src[j] = Read (static_cast<size_t> (idx));
+                }
+            }
+            
+            for (size_t k = 0; k < n; k++)
+            {
+                const float *x = src + (static_cast<int64_t> (ToIndex (pos)) - lo);
+                
+                if constexpr (Interpolate)
+                {
+                    const float a = Halfband::Process (x);
+                    const float b = Halfband::Process (x + 1);
+                    out[i + k] = a + (b - a) * Frac (pos);
+                }
+                else
+                {
+                    out[i + k] = Halfband::Process (x);
+                }
+                
+                pos += step;
             }
+            
+            i += n;
         }
+        
+        head.pos = pos;
     }
     
-    size_t buffer_size_ = 0;
-    float *buff_ = nullptr;
+    Phase buffer_size_ = 0;
+    LoopStorage storage_;
+    
+    Head heads_[kMaxHeads];
+    SliceIndex slices_;
     
-    float pos_ = 0;
+    bool anti_alias_ = true;
     
-    float inc_ = 0;
+    bool zero_cross_ = false;
+    bool state_pending_ = false;
+    size_t state_wait_ = 0;
+    unsigned manip_pending_ = 0; // a bit per head
+    
+    GrainCloud cloud_;
+    SilenceMap silence_;
+    bool played_loud_ = false; // the last block read something that wasn't silence
+    size_t silence_credit_ = 0; // rescan samples owed, short of a whole silence block
+    bool granular_ = false;
+    float grain_pitch_ = 1.f;
+    
+    LoopOverview *overview_ = nullptr;
+    size_t rescan_pos_ = 0;
+    size_t rescan_left_ = 0;
+    
+    Take takes_[kMaxTakes];
+    size_t num_takes_ = 0;
+    size_t take_pos_ = 0;    // current take, counted from the oldest
+    size_t oldest_take_ = 0; // slot of the oldest take
+    
+    SeamFinder *seam_finder_ = nullptr;
+    uint32_t seam_id_ = 0;
+    
+    LoopBouncer *bouncer_ = nullptr;
+    uint32_t bounce_id_ = 0; // bumped whenever a bounce still running would be stale
+    Phase bounce_length_ = 0;
+    uint32_t bounce_count_ = 0;
+    uint32_t bounce_failures_ = 0;
+    
+    bool length_locked_ = false; // recording length was set, keep it
     
     bool recsize_reset_ = false;
     
     bool recorded_in_reverse_ = false;
     
-    float selected_segment_ = 0.f;
-    int num_segments_;
-    
-    float recsize_ = 0;
-    size_t loop_size_ = 0;
-    float loop_start_pos_ = 0;
-    float loop_end_pos_ = 0;
+    Phase recsize_ = 0;
+    Phase loop_start_pos_ = 0;
+    Phase loop_end_pos_ = 0;
     bool loop_reset_ = false;
     
+    Phase loop_clock_ = 0;
+    int64_t loop_cycles_ = 0;
+    
     float fade_samples = 10.f;
 };
@@ -0,0 +1,304 @@
+#include "rt_check.h"
+
+#if LOOPER_RT_CHECKS
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <streambuf>
+
+#if defined(__GLIBC__)
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define LOOPER_RT_BACKTRACE 1
+#else
+#define LOOPER_RT_BACKTRACE 0
+#endif
+
+namespace
+{
+    // everything here is constant initialised, the hooks can run before main
+    struct Site {
+        std::atomic<uint64_t> key {0}; // hash of the stack, 0 while the slot is free
+        std::atomic<bool> ready {false};
+        std::atomic<uint64_t> count {0};
+        int kind = 0;
+        int num_frames = 0;
+        void *frames[RtCheck::kMaxFrames] = {};
+    };
+
+    std::atomic<uint64_t> counts[RtCheck::kNumKinds] = {};
+    std::atomic<uint64_t> dropped {0}; // violations from stacks that didn't fit in sites
+    Site sites[RtCheck::kMaxSites];
+
+    thread_local int depth = 0;
+    thread_local bool reporting = false; // so recording a violation doesn't record its own
+
+    const char *const kKindNames[RtCheck::kNumKinds] = {"malloc", "free", "mutex lock", "stream write"};
+
+    uint64_t HashStack (int kind, void *const *frames, int n)
+    {
+        uint64_t h = 14695981039346656037ull ^ static_cast<uint64_t> (kind);
+        for (int i = 0; i < n; i++)
+        {
+            h ^= reinterpret_cast<uintptr_t> (frames[i]);
+            h *= 1099511628211ull;
+        }
+        return h == 0 ? 1 : h;
+    }
+
+    void Record (RtCheck::Kind kind)
+    {
+        counts[kind].fetch_add (1, std::memory_order_relaxed);
+
+        // the first frame is always Violation()
+        void *frames[RtCheck::kMaxFrames + 1];
+        int n = 0;
+#if LOOPER_RT_BACKTRACE
+        n = std::max (backtrace (frames, static_cast<int> (RtCheck::kMaxFrames + 1)) - 1, 0);
+#endif
+        void **stack = frames + 1;
+        const uint64_t key = HashStack (kind, stack, n);
+
+        for (size_t probe = 0; probe < RtCheck::kMaxSites; probe++)
+        {
+            Site &site = sites[(key + probe) % RtCheck::kMaxSites];
+
+            uint64_t expected = 0;
+            if (site.key.compare_exchange_strong (expected, key, std::memory_order_relaxed))
+            {
+                site.kind = kind;
+                site.num_frames = n;
+                std::copy (stack, stack + n, site.frames);
+                site.ready.store (true, std::memory_order_release);
+            }
+            else if (expected != key)
+            {
+                continue;
+            }
+
+            site.count.fetch_add (1, std::memory_order_relaxed);
+            return;
+        }
+
+        dropped.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    // passes everything on to the stream's own buffer, counting each write
+    class CheckedStreamBuf : public std::streambuf
+    {
+    public:
+        explicit CheckedStreamBuf (std::streambuf *dest) : dest_ (dest) {}
+
+    protected:
+        int_type overflow (int_type c) override
+        {
+            if (traits_type::eq_int_type (c, traits_type::eof()))
+                return traits_type::not_eof (c);
+
+            RtCheck::Violation (RtCheck::STREAM);
+            return dest_->sputc (traits_type::to_char_type (c));
+        }
+
+        std::streamsize xsputn (const char *s, std::streamsize n) override
+        {
+            RtCheck::Violation (RtCheck::STREAM);
+            return dest_->sputn (s, n);
+        }
+
+        int sync() override { return dest_->pubsync(); }
+
+    private:
+        std::streambuf *dest_;
+    };
+}
+
+void RtCheck::Install()
+{
+    static const bool installed = []
+    {
+#if LOOPER_RT_BACKTRACE
+        // the first walk loads the unwinder, which allocates
+        void *warm[1];
+        backtrace (warm, 1);
+#endif
+        static CheckedStreamBuf out (std::cout.rdbuf());
+        static CheckedStreamBuf err (std::cerr.rdbuf());
+        static CheckedStreamBuf log (std::clog.rdbuf());
+        std::cout.rdbuf (&out);
+        std::cerr.rdbuf (&err);
+        std::clog.rdbuf (&log);
+        return true;
+    }();
+    (void) installed;
+}
+
+void RtCheck::Enter() { depth++; }
+void RtCheck::Leave() { depth--; }
+bool RtCheck::InAudioScope() { return depth > 0; }
+
+void RtCheck::Violation (Kind kind)
+{
+    if (depth == 0 || reporting)
+        return;
+
+    reporting = true;
+    Record (kind);
+    reporting = false;
+}
+
+uint64_t RtCheck::Count (Kind kind) { return counts[kind].load (std::memory_order_relaxed); }
+
+uint64_t RtCheck::Total()
+{
+    uint64_t total = 0;
+    for (int k = 0; k < kNumKinds; k++)
+        total += Count (static_cast<Kind> (k));
+    return total;
+}
+
+void RtCheck::Reset()
+{
+    for (auto &c : counts)
+        c.store (0, std::memory_order_relaxed);
+
+    for (auto &site : sites)
+    {
+        site.ready.store (false, std::memory_order_relaxed);
+        site.count.store (0, std::memory_order_relaxed);
+        site.key.store (0, std::memory_order_relaxed);
+    }
+    dropped.store (0, std::memory_order_relaxed);
+}
+
+void RtCheck::Print (std::ostream &out)
+{
+    out << "audio thread violations: " << Total() << "\n";
+    for (int k = 0; k < kNumKinds; k++)
+        out << "  " << kKindNames[k] << ": " << Count (static_cast<Kind> (k)) << "\n";
+
+    for (const auto &site : sites)
+    {
+        if (! site.ready.load (std::memory_order_acquire))
+            continue;
+
+        out << "\n" << kKindNames[site.kind] << " x" << site.count.load (std::memory_order_relaxed) << "\n";
+#if LOOPER_RT_BACKTRACE
+        char **symbols = backtrace_symbols (site.frames, site.num_frames);
+        for (int i = 0; i < site.num_frames; i++)
+            out << "    " << (symbols != nullptr ? symbols[i] : "?") << "\n";
+        std::free (symbols);
+#else
+        out << "    no stack on this platform\n";
+#endif
+    }
+
+    if (dropped.load (std::memory_order_relaxed) > 0)
+        out << "\n" << dropped.load (std::memory_order_relaxed) << " more from stacks that didn't fit\n";
+}
+
+//==============================================================================
+// hooks, only calls made inside a Scope are counted
+
+#if defined(__GLIBC__)
+extern "C"
+{
+    void* __libc_malloc (size_t size);
+    void* __libc_calloc (size_t n, size_t size);
+    void* __libc_realloc (void *p, size_t size);
+    void* __libc_memalign (size_t align, size_t size);
+    void __libc_free (void *p);
+
+    void* malloc (size_t size) noexcept
+    {
+        RtCheck::Violation (RtCheck::ALLOC);
+        return __libc_malloc (size);
+    }
+
+    void* calloc (size_t n, size_t size) noexcept
+    {
+        RtCheck::Violation (RtCheck::ALLOC);
+        return __libc_calloc (n, size);
+    }
+
+    void* realloc (void *p, size_t size) noexcept
+    {
+        RtCheck::Violation (RtCheck::ALLOC);
+        return __libc_realloc (p, size);
+    }
+
+    void* memalign (size_t align, size_t size) noexcept
+    {
+        RtCheck::Violation (RtCheck::ALLOC);
+        return __libc_memalign (align, size);
+    }
+
+    void* aligned_alloc (size_t align, size_t size) noexcept
+    {
+        RtCheck::Violation (RtCheck::ALLOC);
+        return __libc_memalign (align, size);
+    }
+
+    int posix_memalign (void **p, size_t align, size_t size) noexcept
+    {
+        if (align % sizeof (void*) != 0 || (align & (align - 1)) != 0)
+            return EINVAL;
+
+        RtCheck::Violation (RtCheck::ALLOC);
+        *p = __libc_memalign (align, size);
+        return *p != nullptr ? 0 : ENOMEM;
+    }
+
+    void free (void *p) noexcept
+    {
+        if (p != nullptr)
+            RtCheck::Violation (RtCheck::FREE);
+        __libc_free (p);
+    }
+
+    int pthread_mutex_lock (pthread_mutex_t *m) noexcept
+    {
+        using LockFn = int (*) (pthread_mutex_t*);
+        static std::atomic<LockFn> real {nullptr};
+
+        LockFn fn = real.load (std::memory_order_relaxed);
+        if (fn == nullptr)
+        {
+            fn = reinterpret_cast<LockFn> (dlsym (RTLD_NEXT, "pthread_mutex_lock"));
+            real.store (fn, std::memory_order_relaxed);
+        }
+
+        RtCheck::Violation (RtCheck::LOCK);
+        return fn (m);
+    }
+}
+#else
+void* operator new (std::size_t size)
+{
+    RtCheck::Violation (RtCheck::ALLOC);
+    if (void *p = std::malloc (size > 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size) { return operator new (size); }
+
+void operator delete (void *p) noexcept
+{
+    if (p != nullptr)
+        RtCheck::Violation (RtCheck::FREE);
+    std::free (p);
+}
+
+void operator delete[] (void *p) noexcept { operator delete (p); }
+void operator delete (void *p, std::size_t) noexcept { operator delete (p); }
+void operator delete[] (void *p, std::size_t) noexcept { operator delete (p); }
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// build with LOOPER_RT_CHECKS=1 to catch anything on the audio thread that
+// could block, the hooks only see calls made from the executable's own
+// process image so it's for a test harness, not a plugin loaded in a host
+#ifndef LOOPER_RT_CHECKS
+#define LOOPER_RT_CHECKS 0
+#endif
+
+class RtCheck
+{
+public:
+    /**
+           @brief Real-time safety checks for the audio callback.
+                - A Scope marks the callback on the thread running it, nesting is fine
+                - Inside one, malloc/free, mutex locks and writes to std::cout,
+                  std::cerr and std::clog are counted as violations
+                - Each violation's call stack is kept the first time it's seen and
+                  counted after that, Print() symbolises them off the audio thread
+                - Compiles to nothing unless LOOPER_RT_CHECKS is set. malloc and
+                  mutex hooks are glibc only, elsewhere operator new and delete
+                  are checked instead of malloc and locks aren't
+    */
+    enum Kind {
+        ALLOC,
+        FREE,
+        LOCK,
+        STREAM,
+        kNumKinds
+    };
+
+    static constexpr size_t kMaxFrames = 16;
+    static constexpr size_t kMaxSites = 128;
+
+    class Scope
+    {
+    public:
+#if LOOPER_RT_CHECKS
+        Scope() { Enter(); }
+        ~Scope() { Leave(); }
+#else
+        Scope() {}
+#endif
+        Scope (const Scope&) = delete;
+        Scope& operator= (const Scope&) = delete;
+    };
+
+#if LOOPER_RT_CHECKS
+    /** Hooks the streams and warms up the stack walker, call once before any
+        audio runs. The malloc and lock hooks are always in.
+    */
+    static void Install();
+
+    static void Enter();
+    static void Leave();
+    static bool InAudioScope();
+
+    /** Counts a violation of kind if this thread is inside a Scope */
+    static void Violation (Kind kind);
+
+    static uint64_t Count (Kind kind);
+    static uint64_t Total();
+
+    /** Forgets every violation so far, don't call while audio is running */
+    static void Reset();
+
+    /** Writes the counts and a stack for each place a violation came from */
+    static void Print (std::ostream &out);
+#else
+    static void Install() {}
+    static void Violation (Kind) {}
+    static uint64_t Count (Kind) { return 0; }
+    static uint64_t Total() { return 0; }
+    static void Reset() {}
+    static void Print (std::ostream&) {}
+#endif
+};
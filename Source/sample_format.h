@@ -0,0 +1,212 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__F16C__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+#include <arm_neon.h>
+#endif
+
+/** Conversions between float and IEEE 754 half precision loop storage.
+    Half floats keep ~11 bits of precision relative to the signal level,
+    so quiet material doesn't lose resolution the way fixed point does,
+    and need no per-block scale state when the looper writes a sample at a time.
+*/
+namespace sample_format
+{
+/** Scalar float -> half, round to nearest even.
+    Adapted from Fabian Giesen's float_to_half_fast3_rtne (public domain)
+*/
+inline uint16_t FloatToHalf (float f)
+{
+#if defined(__F16C__)
+    return static_cast<uint16_t> (_cvtss_sh (f, 0));
+#else
+    uint32_t x;
+    std::memcpy (&x, &f, sizeof (x));
+
+    const uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint32_t h;
+    if (x >= 0x47800000u) // too big for half, inf or nan
+    {
+        h = x > 0x7f800000u ? 0x7e00u : 0x7c00u;
+    }
+    else if (x < 0x38800000u) // half subnormal or zero
+    {
+        // add a magic value so the fpu does the rounding into the bottom 10 bits
+        const uint32_t magic_bits = 126u << 23;
+        float magic, v;
+        std::memcpy (&magic, &magic_bits, sizeof (magic));
+        std::memcpy (&v, &x, sizeof (v));
+        v += magic;
+        std::memcpy (&h, &v, sizeof (h));
+        h -= magic_bits;
+    }
+    else
+    {
+        const uint32_t mant_odd = (x >> 13) & 1u;
+        x += (static_cast<uint32_t> (15 - 127) << 23) + 0xfffu + mant_odd;
+        h = x >> 13;
+    }
+    return static_cast<uint16_t> (h | (sign >> 16));
+#endif
+}
+
+/** Scalar half -> float, exact.
+    Adapted from Fabian Giesen's half_to_float (public domain)
+*/
+inline float HalfToFloat (uint16_t h)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss (h);
+#else
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t o = (h & 0x7fffu) << 13;
+    const uint32_t exp = o & shifted_exp;
+    o += static_cast<uint32_t> (127 - 15) << 23;
+
+    float f;
+    if (exp == shifted_exp) // inf or nan
+    {
+        o += static_cast<uint32_t> (128 - 16) << 23;
+        std::memcpy (&f, &o, sizeof (f));
+    }
+    else if (exp == 0) // zero or subnormal, renormalise
+    {
+        o += 1u << 23;
+        const uint32_t magic_bits = 113u << 23;
+        float magic;
+        std::memcpy (&magic, &magic_bits, sizeof (magic));
+        std::memcpy (&f, &o, sizeof (f));
+        f -= magic;
+    }
+    else
+    {
+        std::memcpy (&f, &o, sizeof (f));
+    }
+    return (h & 0x8000u) ? -f : f;
+#endif
+}
+
+/** Block half -> float, vectorised where the target allows */
+inline void HalfToFloat (const uint16_t *src, float *dst, size_t size)
+{
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (src + i));
+        _mm256_storeu_ps (dst + i, _mm256_cvtph_ps (h));
+    }
+#elif defined(__ARM_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+    for (; i + 4 <= size; i += 4)
+    {
+        const float16x4_t h = vreinterpret_f16_u16 (vld1_u16 (src + i));
+        vst1q_f32 (dst + i, vcvt_f32_f16 (h));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    // same bit manipulation as the scalar version, with the special cases
+    // selected by masks rather than branches
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mant_exp_mask = _mm_set1_epi32 (0x7fff);
+    const __m128i sign_mask = _mm_set1_epi32 (0x8000);
+    const __m128i shifted_exp = _mm_set1_epi32 (0x7c00 << 13);
+    const __m128i exp_adjust = _mm_set1_epi32 ((127 - 15) << 23);
+    const __m128i inf_adjust = _mm_set1_epi32 ((128 - 16) << 23);
+    const __m128i denorm_adjust = _mm_set1_epi32 (1 << 23);
+    const __m128 magic = _mm_castsi128_ps (_mm_set1_epi32 (113 << 23));
+
+    auto convert4 = [&](__m128i h) -> __m128 {
+        __m128i o = _mm_slli_epi32 (_mm_and_si128 (h, mant_exp_mask), 13);
+        const __m128i exp = _mm_and_si128 (o, shifted_exp);
+        o = _mm_add_epi32 (o, exp_adjust);
+
+        const __m128i is_inf = _mm_cmpeq_epi32 (exp, shifted_exp);
+        o = _mm_add_epi32 (o, _mm_and_si128 (is_inf, inf_adjust));
+
+        const __m128i is_denorm = _mm_cmpeq_epi32 (exp, zero);
+        const __m128 denorm = _mm_sub_ps (_mm_castsi128_ps (_mm_add_epi32 (o, denorm_adjust)), magic);
+        __m128 f = _mm_or_ps (_mm_and_ps (_mm_castsi128_ps (is_denorm), denorm),
+                              _mm_andnot_ps (_mm_castsi128_ps (is_denorm), _mm_castsi128_ps (o)));
+
+        const __m128i sign = _mm_slli_epi32 (_mm_and_si128 (h, sign_mask), 16);
+        return _mm_or_ps (f, _mm_castsi128_ps (sign));
+    };
+
+    for (; i + 8 <= size; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (src + i));
+        _mm_storeu_ps (dst + i, convert4 (_mm_unpacklo_epi16 (h, zero)));
+        _mm_storeu_ps (dst + i + 4, convert4 (_mm_unpackhi_epi16 (h, zero)));
+    }
+#endif
+    for (; i < size; i++)
+        dst[i] = HalfToFloat (src[i]);
+}
+
+/** Block float -> half, vectorised where the target allows */
+inline void FloatToHalf (const float *src, uint16_t *dst, size_t size)
+{
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8)
+    {
+        const __m128i h = _mm256_cvtps_ph (_mm256_loadu_ps (src + i), 0);
+        _mm_storeu_si128 (reinterpret_cast<__m128i*> (dst + i), h);
+    }
+#elif defined(__ARM_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+    for (; i + 4 <= size; i += 4)
+    {
+        const float16x4_t h = vcvt_f16_f32 (vld1q_f32 (src + i));
+        vst1_u16 (dst + i, vreinterpret_u16_f16 (h));
+    }
+#endif
+    for (; i < size; i++)
+        dst[i] = FloatToHalf (src[i]);
+}
+
+/** Caches one aligned block of decoded half samples, so per-sample reads
+    from half storage cost a block conversion every kBlockSize samples rather
+    than a scalar conversion for every tap of the interpolator.
+    Works in either read direction since blocks are aligned, not read ahead.
+*/
+class HalfBlockReader
+{
+public:
+    static constexpr size_t kBlockSize = 64;
+
+    static size_t BlockBase (size_t pos) { return pos & ~(kBlockSize - 1); }
+
+    void Reset() { base_ = kNoBlock; }
+
+    bool Contains (size_t pos) const { return BlockBase (pos) == base_; }
+
+    /** Decodes len (<= kBlockSize) samples from src as the block starting at base */
+    void Fill (const uint16_t *src, size_t len, size_t base)
+    {
+        HalfToFloat (src, block_, len);
+        base_ = base;
+    }
+
+    float Get (size_t pos) const { return block_[pos - base_]; }
+
+    // keep the cached block in step with writes to the storage
+    void Update (size_t pos, uint16_t h)
+    {
+        if (Contains (pos))
+            block_[pos - base_] = HalfToFloat (h);
+    }
+
+private:
+    static constexpr size_t kNoBlock = ~static_cast<size_t> (0);
+
+    size_t base_ = kNoBlock;
+    float block_[kBlockSize];
+};
+
+} // namespace sample_format
@@ -0,0 +1,213 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+class SeamFinder
+{
+public:
+    /**
+           @brief Finds a seamless loop point on a worker thread.
+                - The audio thread copies a window from the start of the recording
+                  and one from its end into the finder and submits them
+                - The worker puts the new loop start on the zero crossing nearest
+                  the start window's centre, then slides a window over the end of
+                  the recording to find the end that best continues into it
+                  (normalised cross-correlation)
+                - The result is handed back through an atomic state, the audio
+                  thread polls for it once per block and never waits
+    */
+    static constexpr size_t kHalfWindow = 256;
+    static constexpr size_t kSearch = 2048;
+    static constexpr size_t kStartLen = 3 * kHalfWindow;
+    static constexpr size_t kEndLen = kSearch + 2 * kHalfWindow;
+
+    SeamFinder() {}
+    ~SeamFinder() { Stop(); }
+    SeamFinder (const SeamFinder&) = delete;
+    SeamFinder& operator= (const SeamFinder&) = delete;
+
+    /** Starts the worker, don't call from the audio thread */
+    void Start()
+    {
+        if (worker_.joinable())
+            return;
+
+        running_.store (true);
+        worker_ = std::thread ([this] { Run(); });
+    }
+
+    void Stop()
+    {
+        running_.store (false);
+
+        if (worker_.joinable())
+            worker_.join();
+
+        state_.store (IDLE);
+    }
+
+    //====================================================
+    // audio thread
+
+    /** True when a new search can be submitted */
+    bool IsIdle() const { return state_.load (std::memory_order_acquire) == IDLE; }
+
+    /** The first kStartLen samples of the recording, fill before Submit() */
+    float* StartWindow() { return start_; }
+
+    /** The last kEndLen samples of the recording, fill before Submit() */
+    float* EndWindow() { return end_; }
+
+    void Submit (uint32_t id)
+    {
+        request_id_ = id;
+        state_.store (REQUESTED, std::memory_order_release);
+    }
+
+    /** Collects a finished search. Returns true if it was for request id, with
+        start as an offset into StartWindow() and end as an offset into EndWindow().
+        Results for any other request are dropped.
+    */
+    bool GetResult (uint32_t id, size_t &start, size_t &end)
+    {
+        if (state_.load (std::memory_order_acquire) != DONE)
+            return false;
+
+        const bool ours = request_id_ == id;
+        start = result_start_;
+        end = result_end_;
+
+        state_.store (IDLE, std::memory_order_release);
+        return ours;
+    }
+
+private:
+    enum State {
+        IDLE,
+        REQUESTED,
+        BUSY,
+        DONE
+    };
+
+    void Run()
+    {
+        while (running_.load())
+        {
+            int expected = REQUESTED;
+            if (state_.compare_exchange_strong (expected, BUSY, std::memory_order_acquire))
+            {
+                Search();
+                state_.store (DONE, std::memory_order_release);
+                continue;
+            }
+
+            std::this_thread::sleep_for (std::chrono::milliseconds (2));
+        }
+    }
+
+    void Search()
+    {
+        // loop start on the zero crossing nearest the centre of the start window,
+        // leaving kHalfWindow either side for the correlation
+        const size_t centre = kStartLen / 2;
+        size_t s = centre;
+        for (size_t d = 0; d <= kHalfWindow / 2; d++)
+        {
+            if (IsZeroCrossing (centre + d))
+            {
+                s = centre + d;
+                break;
+            }
+            if (IsZeroCrossing (centre - d))
+            {
+                s = centre - d;
+                break;
+            }
+        }
+
+        const float *ref = start_ + s - kHalfWindow;
+        const size_t len = 2 * kHalfWindow;
+        const float ref_energy = Dot (ref, ref, len);
+
+        // energy of the sliding end window, updated a sample at a time
+        float energy = Dot (end_, end_, len);
+
+        size_t best = kSearch;
+        float best_score = -2.f;
+
+        for (size_t c = 0; c <= kSearch; c++)
+        {
+            const float norm = std::sqrt (std::max (energy, 0.f) * ref_energy);
+            const float score = norm > 1.0e-12f ? Dot (end_ + c, ref, len) / norm : 0.f;
+
+            if (score > best_score)
+            {
+                best_score = score;
+                best = c;
+            }
+
+            if (c < kSearch)
+                energy += end_[c + len] * end_[c + len] - end_[c] * end_[c];
+        }
+
+        result_start_ = s;
+        result_end_ = best + kHalfWindow;
+    }
+
+    bool IsZeroCrossing (size_t i) const
+    {
+        return (start_[i - 1] < 0.f) != (start_[i] < 0.f);
+    }
+
+    /** Vectorised dot product, the correlation kernel */
+    static float Dot (const float *a, const float *b, size_t size)
+    {
+        size_t i = 0;
+        float sum = 0.f;
+#if defined(__SSE__) || defined(_M_X64)
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        for (const size_t vec_end = size - size % 8; i < vec_end; i += 8)
+        {
+            acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+            acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (a + i + 4), _mm_loadu_ps (b + i + 4)));
+        }
+        alignas (16) float lanes[4];
+        _mm_store_ps (lanes, _mm_add_ps (acc0, acc1));
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+        float32x4_t acc = vdupq_n_f32 (0.f);
+        for (const size_t vec_end = size - size % 4; i < vec_end; i += 4)
+            acc = vmlaq_f32 (acc, vld1q_f32 (a + i), vld1q_f32 (b + i));
+        float lanes[4];
+        vst1q_f32 (lanes, acc);
+        sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+        for (; i < size; i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    std::thread worker_;
+    std::atomic<bool> running_ {false};
+    std::atomic<int> state_ {IDLE};
+
+    // owned by whichever side the state says, handed over with state_
+    uint32_t request_id_ = 0;
+    size_t result_start_ = 0;
+    size_t result_end_ = 0;
+    float start_[kStartLen] = {};
+    float end_[kEndLen] = {};
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "loop_storage.h"
+
+class SilenceMap
+{
+public:
+    /**
+           @brief A bit per kBlockSize samples of the loop buffer, set when every
+                  sample in the block is below kThreshold, so playback can write
+                  zeros for it instead of reading and interpolating.
+                - Recording marks the block it's writing as loud, and checks it
+                  against the storage once it moves on or the audio block ends, so
+                  samples a pass skipped over or didn't reach are counted too
+                - A range is only silent if every block it touches is, so a reader
+                  asks for the samples it reads including any filter reach
+                - A restored take is rescanned a few blocks at a time, everything
+                  counts as loud until its block has been looked at
+                - Audio thread only
+    */
+    static constexpr size_t kBlockSize = 64;
+    static constexpr float kThreshold = 1.0e-5f; // -100dB
+
+    /** Sizes the map for a buffer of size samples, all silent as the buffer
+        starts zeroed. Don't call from the audio thread.
+    */
+    void Init (size_t size)
+    {
+        size_ = size;
+        num_blocks_ = (size + kBlockSize - 1) / kBlockSize;
+        bits_.assign ((num_blocks_ + 63) / 64, ~static_cast<uint64_t> (0));
+        cur_block_ = kNoBlock;
+        rescan_left_ = 0;
+    }
+
+    /** Recording is about to write pos */
+    inline void Touch (LoopStorage &storage, size_t pos)
+    {
+        const size_t block = pos / kBlockSize;
+        if (block == cur_block_)
+            return;
+
+        Flush (storage);
+        cur_block_ = block;
+        Set (block, false);
+    }
+
+    /** Checks the block recording was writing, call at the end of each recorded block */
+    void Flush (LoopStorage &storage)
+    {
+        if (cur_block_ != kNoBlock)
+            Check (storage, cur_block_);
+        cur_block_ = kNoBlock;
+    }
+
+    /** The storage was swapped for other contents, everything is loud until Rescan() reaches it */
+    void StartRescan()
+    {
+        std::fill (bits_.begin(), bits_.end(), 0);
+        cur_block_ = kNoBlock;
+        rescan_block_ = 0;
+        rescan_left_ = num_blocks_;
+    }
+
+    bool IsRescanning() const { return rescan_left_ > 0; }
+
+    /** Checks up to max_blocks more blocks of a rescan */
+    void Rescan (LoopStorage &storage, size_t max_blocks)
+    {
+        for (size_t n = std::min (max_blocks, rescan_left_); n > 0; n--)
+        {
+            Check (storage, rescan_block_);
+            rescan_block_++;
+            rescan_left_--;
+        }
+    }
+
+    /** True if every sample from index first to last is in a silent block.
+        Either may be off the ends of the buffer, they wrap round.
+    */
+    bool IsSilent (int64_t first, int64_t last) const
+    {
+        if (num_blocks_ == 0 || last < first)
+            return false;
+
+        const int64_t size = static_cast<int64_t> (size_);
+        if (last - first + 1 >= size)
+            return AllSilent();
+
+        size_t start = static_cast<size_t> (((first % size) + size) % size);
+        size_t len = static_cast<size_t> (last - first + 1);
+
+        while (len > 0)
+        {
+            // split where the range wraps round the end of the buffer
+            const size_t run = std::min (len, size_ - start);
+            for (size_t b = start / kBlockSize; b <= (start + run - 1) / kBlockSize; b++)
+                if (! Get (b))
+                    return false;
+
+            start = 0;
+            len -= run;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t kNoBlock = ~static_cast<size_t> (0);
+
+    bool Get (size_t block) const { return (bits_[block / 64] >> (block % 64)) & 1; }
+
+    void Set (size_t block, bool silent)
+    {
+        const uint64_t mask = static_cast<uint64_t> (1) << (block % 64);
+        bits_[block / 64] = silent ? (bits_[block / 64] | mask) : (bits_[block / 64] & ~mask);
+    }
+
+    bool AllSilent() const
+    {
+        for (size_t b = 0; b < num_blocks_; b++)
+            if (! Get (b))
+                return false;
+        return true;
+    }
+
+    void Check (LoopStorage &storage, size_t block)
+    {
+        float samples[kBlockSize];
+        const size_t start = block * kBlockSize;
+        const size_t len = std::min (kBlockSize, size_ - start);
+        storage.ReadRun (start, samples, len);
+
+        float peak = 0.f;
+        for (size_t i = 0; i < len; i++)
+            peak = std::max (peak, std::fabs (samples[i]));
+
+        Set (block, peak < kThreshold);
+    }
+
+    size_t size_ = 0;
+    size_t num_blocks_ = 0;
+    std::vector<uint64_t> bits_;
+
+    size_t cur_block_ = kNoBlock;
+    size_t rescan_block_ = 0;
+    size_t rescan_left_ = 0;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "dsp.h"
+
+class SliceIndex
+{
+public:
+    /**
+           @brief Finds transients in the input while a loop is recording and keeps
+                  the slice points between them, so the slices are ready the moment
+                  recording stops, with no analysis pass.
+                - Onsets are detected from the high frequency energy (the energy of
+                  the first difference) of each hop, against its recent average
+                - Slice points are offsets along the recording, in the looper's
+                  32.32 fixed point, and the first slice always starts at 0
+                - Fixed capacity, nothing is allocated
+    */
+    using Phase = int64_t;
+    static constexpr size_t kMaxSlices = 128;
+
+    void Reset()
+    {
+        num_slices_ = 1;
+        offsets_[0] = 0;
+        prev_ = 0.f;
+        acc_ = 0.f;
+        count_ = 0;
+        avg_ = 0.f;
+        hops_since_onset_ = 0;
+    }
+
+    /** Feeds one recorded sample, offset is how far along the recording it was
+        written, so slices line up with reverse and half speed recordings too
+    */
+    inline void Analyse (float in, Phase offset)
+    {
+        if (count_ == 0)
+            hop_start_ = offset;
+
+        const float hf = in - prev_;
+        prev_ = in;
+        acc_ += hf * hf;
+
+        if (++count_ < kHop)
+            return;
+
+        const float energy = acc_ * (1.f / kHop);
+
+        // slices start at the top of the hop the transient was found in,
+        // so the attack isn't cut off
+        if (energy > kFloor
+            && energy > avg_ * kThreshold
+            && hops_since_onset_ >= kMinGapHops
+            && num_slices_ < kMaxSlices)
+        {
+            offsets_[num_slices_++] = hop_start_;
+            hops_since_onset_ = 0;
+        }
+        else
+        {
+            hops_since_onset_++;
+        }
+
+        daisysp::fonepole (avg_, energy, kAvgCoeff);
+
+        acc_ = 0.f;
+        count_ = 0;
+    }
+
+    /** Number of slices that start inside a recording of length */
+    size_t NumSlices (Phase length) const
+    {
+        size_t n = num_slices_;
+        while (n > 1 && offsets_[n - 1] >= length)
+            n--;
+        return n;
+    }
+
+    Phase GetOffset (size_t slice) const { return offsets_[slice]; }
+
+    /** Moves the start of the recording on by from, e.g. to a new loop point */
+    void Trim (Phase from)
+    {
+        size_t n = 1;
+        for (size_t i = 1; i < num_slices_; i++)
+            if (offsets_[i] > from)
+                offsets_[n++] = offsets_[i] - from;
+        num_slices_ = n;
+    }
+
+private:
+    static constexpr size_t kHop = 256;
+    static constexpr size_t kMinGapHops = 4;  // ~20ms at 48kHz
+    static constexpr float kThreshold = 4.f;  // jump over the recent average, ~6dB
+    static constexpr float kFloor = 1.0e-5f;  // ignore onsets in the noise floor
+    static constexpr float kAvgCoeff = 0.2f;
+
+    Phase offsets_[kMaxSlices] = {};
+    size_t num_slices_ = 1;
+
+    Phase hop_start_ = 0;
+    float prev_ = 0.f;
+    float acc_ = 0.f;
+    size_t count_ = 0;
+    float avg_ = 0.f;
+    size_t hops_since_onset_ = 0;
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include "looper.h"
+
+class StepSequencer
+{
+public:
+    /**
+           @brief Steps the looper through a pattern of segments and time manipulation
+                  modes, one step per equal division of the loop.
+                - The pattern is compiled to a schedule of step start positions
+                  whenever it or the loop length changes, never allocating
+                - Playback runs up to the next scheduled step and applies it there,
+                  so there's no per sample lookup and steps land on the exact sample
+                - Step positions keep the fractional loop length, so the pattern
+                  stays locked to the loop however long it plays
+    */
+    using Phase = Looper::Phase;
+    static constexpr size_t kMaxSteps = 16;
+
+    struct Step {
+        int segment = 0;
+        Looper::TimeManipulation time_manip = Looper::NORMAL;
+    };
+
+    void SetNumSteps (size_t num_steps)
+    {
+        num_steps = std::min (std::max (num_steps, static_cast<size_t> (1)), kMaxSteps);
+        if (num_steps != num_steps_)
+        {
+            num_steps_ = num_steps;
+            dirty_ = true;
+        }
+    }
+
+    void SetStep (size_t step, int segment, Looper::TimeManipulation time_manip)
+    {
+        Step &s = steps_[step];
+        if (s.segment != segment || s.time_manip != time_manip)
+        {
+            s.segment = segment;
+            s.time_manip = time_manip;
+            dirty_ = true;
+        }
+    }
+
+    /** Length of one pass through the pattern, normally the recording length */
+    void SetLoopLength (Phase length)
+    {
+        if (length != length_)
+        {
+            length_ = length;
+            dirty_ = true;
+        }
+    }
+
+    /** Rebuilds the schedule if the pattern or loop length changed since the last call.
+        The position in the loop is kept, the step it falls in becomes current again.
+    */
+    void Compile()
+    {
+        if (!dirty_)
+            return;
+
+        for (size_t i = 0; i < num_steps_; i++)
+        {
+            // length_ * i / num_steps_ without overflowing on long loops
+            const Phase n = static_cast<Phase> (num_steps_);
+            const Phase k = static_cast<Phase> (i);
+            starts_[i] = (length_ / n) * k + ((length_ % n) * k) / n;
+        }
+
+        // a shortened loop can leave the position past its end
+        if (length_ > 0)
+            pos_ %= length_;
+
+        next_ = 0;
+        while (next_ < num_steps_ && starts_[next_] <= pos_)
+            next_++;
+        current_ = next_ > 0 ? next_ - 1 : 0;
+        pending_ = true;
+
+        dirty_ = false;
+    }
+
+    /** Back to the start of the pattern, the first step is applied straight away */
+    void Reset()
+    {
+        pos_ = 0;
+        next_ = 0;
+        pending_ = false;
+    }
+
+    /** Whole samples that can be processed before the next step starts,
+        0 if one is due now
+    */
+    size_t SamplesToNextStep() const
+    {
+        if (pending_)
+            return 0;
+        if (length_ <= 0)
+            return ~static_cast<size_t> (0);
+
+        const Phase target = next_ < num_steps_ ? starts_[next_] : length_;
+        const Phase remaining = target - pos_;
+        if (remaining <= 0)
+            return 0;
+
+        return static_cast<size_t> ((remaining + Looper::kOne - 1) >> Looper::kFracBits);
+    }
+
+    /** Moves on samples, which must not pass SamplesToNextStep() */
+    void Advance (size_t samples)
+    {
+        pos_ += Looper::ToPhase (samples);
+    }
+
+    /** Returns true if a step starts at the current position, it's then the current step */
+    bool PopStep()
+    {
+        if (length_ <= 0)
+            return false;
+
+        if (pending_)
+        {
+            pending_ = false;
+            return true;
+        }
+
+        if (next_ >= num_steps_ && pos_ >= length_)
+        {
+            pos_ -= length_;
+            next_ = 0;
+        }
+
+        if (next_ < num_steps_ && pos_ >= starts_[next_])
+        {
+            current_ = next_++;
+            return true;
+        }
+
+        return false;
+    }
+
+    const Step& CurrentStep() const { return steps_[current_]; }
+
+private:
+    Step steps_[kMaxSteps];
+    Phase starts_[kMaxSteps] = {};
+    size_t num_steps_ = 1;
+    Phase length_ = 0;
+    bool dirty_ = true;
+
+    Phase pos_ = 0;     // position in the pattern
+    size_t next_ = 0;   // next step to start
+    size_t current_ = 0;
+    bool pending_ = false; // recompiled mid step, reapply it
+};